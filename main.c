@@ -1,21 +1,102 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <time.h>
 #include <math.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
+// volume size in entries used when no geometry is given on the command line
 #define ENTRIES 128
 #define ALLOC_CONTIGUOUS -101
 #define ALLOC_LINKED -102
 #define ALLOC_INDEXED -103
 #define ALLOC_LINKEDCONTIG -104
-#define ALLOC_LINKEDCONTIG -104
+#define ALLOC_BUDDY -105
 #define CSV_NAME "fulltest.csv"
+// bytes read from the instruction file per chunk
+#define CSV_CHUNK (1 << 20)
+#define ACTION_ADD 1
+#define ACTION_READ 2
+#define ACTION_DELETE 3
+#define ACTION_RANGE 4
+#define ACTION_APPEND 5
+#define ACTION_FALLOCATE 6
+#define ACTION_SNAPSHOT 7
+#define ACTION_SNAPRANGE 8
+#define ACTION_SNAPDELETE 9
+#define ACTION_COUNT 9
+// number of blocks tracked by one word of the free-space bitmap
+#define FREEMAP_WORD_BITS 64
+// volumes with at least this many bitmap words use the SIMD scan
+#define FREEMAP_SIMD_MIN_WORDS 8
+// placement policies for contiguous runs
+#define FIT_FIRST 0
+#define FIT_BEST 1
+#define FIT_WORST 2
+// outcome of an add, read or delete
+#define STATUS_OK 0
+#define STATUS_EXISTS 1
+#define STATUS_NOT_FOUND 2
+#define STATUS_NO_SPACE 3
+#define STATUS_NO_ENTRY 4
+// an add held back by delayed allocation, its own status comes when the batch is placed
+#define STATUS_DELAYED 5
+// events held in memory before they are written out
+#define EVENT_BATCH 4096
+// generated workloads, file names are multiples of 100 so sizes stay below 100
+#define BENCH_MAX_SIZE 99
+#define BENCH_MAX_OPS 20000000
+#define BENCH_BLOCKS 16384
+// volume image files, the version changes whenever the layout does
+#define IMAGE_MAGIC 0x31474d4956534f46ULL
+#define IMAGE_VERSION 6
+#define IMAGE_ALIGN 64
+// remembered positions in chained files for reads by offset
+#define CURSOR_SLOTS 64
+// buffer cache replacement policies
+#define CACHE_LRU 0
+#define CACHE_CLOCK 1
+// simulated devices behind the blocks
+#define DEVICE_HDD 1
+#define DEVICE_SSD 2
+#define DEVICE_NVME 3
+// bytes a flash device reads or programs at once
+#define DEVICE_PAGE_BYTES 4096
+// free extents are counted by length in power of two buckets, 1, 2-3, 4-7, ...
+#define EXTENT_BUCKETS 64
+// buddy runs are 2^0 to 2^(BUDDY_ORDERS - 1) blocks
+#define BUDDY_ORDERS 48
+// read/write locks files are hashed onto when a volume is shared between threads
+#define FILE_LOCK_STRIPES 256
+// image sections the journal logs changes to, the rest is rebuilt from them after a crash
+#define JOURNAL_MAGIC 0x4c4e524a
+#define JOURNAL_FILE_ENTRY 0
+#define JOURNAL_FREE_MAP 1
+#define JOURNAL_FAT 2
+#define JOURNAL_BLOCK 3
+#define JOURNAL_SECTIONS 4
+// the image is synced and the journal emptied once it grows past this
+#define JOURNAL_CHECKPOINT_BYTES (64LL << 20)
+
+// block numbers are 64-bit so volumes are not capped at 2^31 blocks
+typedef long long BlockNo;
 
-// block representation
+// block representation, a view into the store data
 typedef struct block
 {
     int *entries;
-    int index;
+    BlockNo index;
 } Block;
 
 // represent a file entry
@@ -23,1168 +104,7252 @@ typedef struct fileEntry
 {
     int allocationType;
     int fileName;
-    int params[2];
+    // contiguous and buddy: start and block count, linked: first and last block, indexed: index block and content blocks
+    BlockNo params[2];
+    // entries of content, so reads by offset know where the file ends
+    BlockNo fileSize;
+    // indexed: bits per entry of content blocks packed by frame of reference, 0 when they hold plain entries
+    int packedBits;
 } FileEntry;
 
+// a run of free blocks, linked into two treaps at once
+typedef struct freeExtent
+{
+    BlockNo start;
+    BlockNo length;
+    // longest extent in this subtree of the by-start tree
+    BlockNo maxLength;
+    // children ordered by start and by (length, start), -1 when absent
+    int left;
+    int right;
+    int sizeLeft;
+    int sizeRight;
+    unsigned int priority;
+} FreeExtent;
+
+// free space as extents, nodes live in a pool and refer to each other by index
+typedef struct extentTree
+{
+    FreeExtent *nodes;
+    int capacity;
+    int used;
+    // recycled nodes chained through left
+    int freeNode;
+    int byStart;
+    int bySize;
+    int count;
+    unsigned int seed;
+    // extents per length bucket, kept up to date by insert and remove
+    int lengthCounts[EXTENT_BUCKETS];
+} ExtentTree;
+
+// units of one image section changed since the last commit
+typedef struct journalSection
+{
+    uint64_t offset;
+    size_t unitSize;
+    int64_t unitCount;
+    // a bit per unit so each one is logged once per commit, and the changed units in order
+    uint64_t *dirty;
+    int64_t *units;
+    int64_t count;
+} JournalSection;
+
+// one group of operations in a journal file, followed by its records
+typedef struct journalCommit
+{
+    uint32_t magic;
+    uint32_t records;
+    // 1 for the first group after a checkpoint
+    uint64_t sequence;
+    // bytes of records after this header
+    uint64_t bytes;
+    uint64_t checksum;
+} JournalCommit;
+
+// a changed range of the image, followed by its bytes padded to a whole word
+typedef struct journalRecord
+{
+    uint64_t offset;
+    uint64_t length;
+} JournalRecord;
+
+// redo journal of an image, the image file only receives changes once the journal holds them
+typedef struct journal
+{
+    int fd;
+    int imageFd;
+    // private mapping of the image, changes stay in memory until they are committed
+    char *base;
+    JournalSection sections[JOURNAL_SECTIONS];
+    // operations per commit, and the ones waiting for the next commit
+    int groupOps;
+    int pendingOps;
+    uint64_t sequence;
+    // bytes written since the last checkpoint
+    long long size;
+    char *buffer;
+    size_t bufferCapacity;
+    int failed;
+    long long operations;
+    long long commits;
+    long long records;
+    long long bytes;
+    long long checkpoints;
+} Journal;
+
+// the directory of a volume at one point in time, its blocks are shared with the live volume until the volume changes them
+typedef struct snapshot
+{
+    int id;
+    // snapshots taken so far, this one included
+    long long generation;
+    FileEntry *fileEntry;
+    int *dirTable;
+    // NULL unless the volume keeps a FAT
+    int *fat;
+    // open-addressing map from a block of the volume to the block holding it as the snapshot saw it, -1 when empty
+    // blocks missing from it are read from the live volume
+    BlockNo *mapFrom;
+    BlockNo *mapTo;
+    BlockNo mapMask;
+    BlockNo mapCount;
+    struct snapshot *older;
+} Snapshot;
+
+// the snapshots of a volume, newest first, and the blocks they hold
+typedef struct snapshotSet
+{
+    Snapshot *newest;
+    long long generation;
+    // per block, the generation the live content of the block dates from
+    long long *blockGeneration;
+    // per block, snapshot map entries pointing at it; a block with any is no longer part of the live volume
+    int *refs;
+    // blocks copied before the live volume changed them, and freed blocks handed to the snapshots as they were
+    long long copies;
+    long long kept;
+    // copies that found the volume full, only of preallocated blocks past the end of a file, which no snapshot reads
+    long long lost;
+} SnapshotSet;
+
 // vcb representation
 typedef struct volumeControlBlock
 {
     int blockSize;
-    int freeBlockNum;
-    Block **freeBlocks;
+    BlockNo freeBlockNum;
+    BlockNo numBlocks;
+    // packed free-space bitmap, bit set means the block is free
+    uint64_t *freeMap;
+    BlockNo freeMapWords;
+    // no free bit exists in the words before this one
+    BlockNo freeMapHint;
+    // the same free space as coalesced extents, for contiguous placement
+    ExtentTree extents;
+    int fitPolicy;
+    // NULL unless the volume is an image kept with a journal
+    Journal *journal;
+    // NULL until the first snapshot is taken
+    SnapshotSet *snapshots;
 } VolumeControlBlock;
 
+// where a content value was written, owner 0 marks an empty slot
+typedef struct contentPosting
+{
+    int value;
+    int owner;
+    BlockNo block;
+} ContentPosting;
+
+// open-addressing multimap from content value to the blocks holding it
+typedef struct contentIndex
+{
+    ContentPosting *slots;
+    size_t mask;
+    size_t count;
+} ContentIndex;
+
+// a content block held in the dedup index, block -1 marks an empty slot
+typedef struct dedupSlot
+{
+    uint64_t fingerprint;
+    BlockNo block;
+} DedupSlot;
+
+// open-addressing map from the fingerprint of a content block's entries to the block, for sharing identical blocks
+typedef struct dedupIndex
+{
+    DedupSlot *slots;
+    size_t mask;
+    size_t count;
+    // per block, index slots of files pointing at it; 0 or 1 for a block only one file uses
+    int *refs;
+    // content blocks written by adds and appends, those that went to an identical block instead, and shared blocks copied back for an append
+    long long written;
+    long long shared;
+    long long unshared;
+} DedupIndex;
+
+// one replayed instruction as written to the event file
+typedef struct storeEvent
+{
+    int32_t allocationType;
+    int32_t action;
+    int32_t fileName;
+    int32_t status;
+    int64_t freeBlocks;
+} StoreEvent;
+
+// block of a chained file the last read by offset stopped in
+typedef struct chainCursor
+{
+    // 0 when the slot is unused
+    int fileName;
+    // file offset of the first entry in block
+    BlockNo offset;
+    BlockNo block;
+} ChainCursor;
+
+// simulated buffer cache in front of the blocks, it only tracks which blocks would be resident
+typedef struct blockCache
+{
+    int policy;
+    int capacity;
+    int used;
+    // block held by each frame and the frame holding each block, -1 when not cached
+    BlockNo *frameBlock;
+    int *frameOf;
+    unsigned char *dirty;
+    unsigned char *referenced;
+    // LRU list of frames, head is the most recently used
+    int *prev;
+    int *next;
+    int head;
+    int tail;
+    // CLOCK hand
+    int hand;
+    long long hits;
+    long long misses;
+    long long writeBacks;
+} BlockCache;
+
+// cost model of the device holding the blocks, times are in microseconds
+typedef struct deviceModel
+{
+    int type;
+    // HDD: seek time grows with the square root of the distance, plus half a rotation
+    double trackSeek;
+    double fullSeek;
+    double halfRotation;
+    double transfer;
+    // SSD and NVMe: latency of a page, divided over the queue for sequential pages
+    double readLatency;
+    double writeLatency;
+    int queueDepth;
+    BlockNo blocksPerPage;
+    BlockNo numBlocks;
+    // last block moved, under the head of a disk
+    BlockNo head;
+    BlockNo lastReadPage;
+    BlockNo lastWritePage;
+    double time;
+    long long seeks;
+    long long pages;
+} DeviceModel;
+
+// free runs of 2^order blocks aligned to their size, for the buddy allocation type
+typedef struct buddyAllocator
+{
+    BlockNo numBlocks;
+    // first free run of each order, -1 when there is none
+    BlockNo heads[BUDDY_ORDERS];
+    // free runs of an order are chained through their first block
+    BlockNo *next;
+    BlockNo *prev;
+    // order of the free run starting at a block, -1 when no free run starts there
+    signed char *order;
+    long long splits;
+    long long merges;
+} BuddyAllocator;
+
+// locks of a volume shared by client threads, always taken in the order declared
+// a file's name and its content values hash to the same file lock, reads by content look in fileName / 100 * 100
+typedef struct storeLocks
+{
+    // reads of a file share its lock, anything that changes it takes it alone
+    pthread_rwlock_t fileLocks[FILE_LOCK_STRIPES];
+    // free map, extents, buddy lists, FAT, free slots, content index and metrics
+    // held by adds, deletes and appends, and by reads that may look at any file
+    pthread_mutex_t allocLock;
+    // directory hash, lookups share it and binding or releasing an entry takes it alone
+    pthread_rwlock_t dirLock;
+    // chain cursors, the buffer cache and device model, and the event buffer
+    pthread_mutex_t sharedLock;
+} StoreLocks;
+
+// layout of the files on a volume, summed over the files as they come and go
+typedef struct volumeMetrics
+{
+    long long files;
+    // runs of adjacent content blocks
+    long long fileExtents;
+    // unused entries at the end of the last content block
+    long long slack;
+    // entries holding block pointers instead of content
+    long long pointerEntries;
+} VolumeMetrics;
+
+// where a store's messages and events go
+typedef struct output
+{
+    // 0 drops the per-entry text, events are still recorded
+    int verbose;
+    // stdout, or a temporary file when the store is replayed on a worker
+    FILE *text;
+    // binary event log, NULL when events are off
+    FILE *eventFile;
+    StoreEvent *events;
+    int eventCount;
+} Output;
+
 // physical store representation
 typedef struct store
 {
     VolumeControlBlock *vcb;
     FileEntry *fileEntry;
     int fileEntrySize;
-    Block *blocks;
-    int numBlocks;
+    // open-addressing index from fileName to fileEntry slot, -1 when empty
+    int *dirTable;
+    int dirTableMask;
+    // stack of unused fileEntry slots, the top is handed out next
+    int *freeSlots;
+    int freeSlotCount;
+    // numBlocks * blockSize entries, block i starts at data + i * blockSize
+    int *data;
+    BlockNo numBlocks;
+    // optional reverse index for reads by content, NULL when disabled
+    ContentIndex *contentIndex;
+    // optional index of indexed content blocks for sharing identical ones, NULL when disabled
+    DedupIndex *dedup;
+    // indexed files are packed when that saves blocks, reads by content then go file by file
+    int compress;
+    // files packed, blocks that saved, and packed files unpacked to grow them
+    long long packedFiles;
+    long long packedSaved;
+    long long unpackedFiles;
+    Output output;
+    // work done so far, as reported by the Traversals and Time lines
+    // atomic so client threads of a shared volume can all count
+    _Atomic long long traversals;
+    _Atomic long long reads;
+    // direct-mapped by file name, dropped when the file is deleted
+    ChainCursor cursors[CURSOR_SLOTS];
+    // NULL when block accesses are not simulated
+    BlockCache *cache;
+    // NULL when block accesses are not timed
+    DeviceModel *device;
+    // work done by the defragmenter so far
+    long long defragMoves;
+    long long defragFiles;
+    // fileEntry slot of each block of a contiguous or linked contiguous file, -1 for the others
+    // NULL until the first defragmentation step, then kept up to date with the metrics
+    int *blockOwners;
+    VolumeMetrics metrics;
+    // NULL unless the volume uses the buddy allocation type
+    BuddyAllocator *buddy;
+    // NULL unless several threads use the volume at once
+    StoreLocks *locks;
+    // next block of each block for linked files, -1 ends a chain
+    // NULL when the chain is kept in the last entry of every block
+    int *fat;
+    // mapped volume image holding the arrays above, NULL when they are malloc'ed
+    struct imageHeader *image;
+    size_t imageSize;
+    // NULL unless adds are placed in batches
+    struct delayedAdds *delayed;
+    // free run reserved for a batch of contiguous files, batchLeft is 0 outside a batch
+    BlockNo batchStart;
+    BlockNo batchLeft;
+    // set on the copy of a store that reads a snapshot, blocks are looked up in its map
+    const Snapshot *view;
 } Store;
 
+// first bytes of a volume image, every section offset is from the start of the file
+typedef struct imageHeader
+{
+    uint64_t magic;
+    uint32_t version;
+    // 0 while mounted, a crash leaves the counters below stale
+    int32_t clean;
+    int32_t allocationType;
+    int32_t blockSize;
+    int32_t fileEntrySize;
+    int32_t dirTableMask;
+    int32_t freeSlotCount;
+    int32_t fitPolicy;
+    int64_t numBlocks;
+    int64_t freeBlockNum;
+    int64_t freeMapHint;
+    // extent tree bookkeeping, its nodes live in the image
+    int32_t extentCapacity;
+    int32_t extentUsed;
+    int32_t extentFreeNode;
+    int32_t extentByStart;
+    int32_t extentBySize;
+    int32_t extentCount;
+    uint32_t extentSeed;
+    uint64_t fileEntryOffset;
+    uint64_t dirTableOffset;
+    uint64_t freeSlotsOffset;
+    uint64_t freeMapOffset;
+    uint64_t extentOffset;
+    // 0 when the volume keeps linked chains in the blocks
+    uint64_t fatOffset;
+    uint64_t dataOffset;
+    uint64_t size;
+} ImageHeader;
+
+// size of a volume, decided at runtime
+typedef struct volumeGeometry
+{
+    int blockSize;
+    BlockNo numBlocks;
+    int fileEntrySize;
+} VolumeGeometry;
+
 typedef struct instruction
 {
-    char *action;
+    int action;
     int fileName;
     int *fileContent;
     int fileSize;
 } Instruction;
 
-Store *createStore(int block_size, int allocationType)
+// parsed workload, the contents of every instruction share one arena
+typedef struct instructionList
 {
-    Store *store = malloc(sizeof(Store));
+    Instruction *items;
+    size_t count;
+    size_t capacity;
+    int *contents;
+    size_t contentCount;
+    size_t contentCapacity;
+} InstructionList;
+
+// an add waiting for its batch, order keeps equal sizes in arrival order
+typedef struct delayedAdd
+{
+    Instruction instruction;
+    size_t contentAt;
+    int order;
+} DelayedAdd;
+
+// adds held back until threshold of them are pending or another instruction needs the volume up to date
+typedef struct delayedAdds
+{
+    int threshold;
+    int allocationType;
+    DelayedAdd *pending;
+    int count;
+    // copies of the pending contents, the caller's may not outlive the instruction
+    int *contents;
+    size_t contentUsed;
+    size_t contentCapacity;
+    // outcome of every add placed so far
+    size_t statusCount[STATUS_NO_ENTRY + 1];
+    long long batches;
+    // full batches of contiguous files that went into a single free run
+    long long packedBatches;
+} DelayedAdds;
 
-    int entrySize = ENTRIES;
-    int leftovers = entrySize % block_size;
-    int numBlocks = entrySize / block_size;
-    int numFileSupported = leftovers - 1;
+void extent_init(ExtentTree *t)
+{
+    t->capacity = 64;
+    t->nodes = malloc(sizeof(FreeExtent) * t->capacity);
+    t->used = 0;
+    t->freeNode = -1;
+    t->byStart = -1;
+    t->bySize = -1;
+    t->count = 0;
+    t->seed = 2463534242u;
+    memset(t->lengthCounts, 0, sizeof(t->lengthCounts));
+}
+
+// bucket of an extent length, floor(log2(length))
+static int extent_bucket(BlockNo length)
+{
+    return 63 - __builtin_clzll((unsigned long long)length);
+}
 
-    // calculate supported number of files such that supported > block
-    while (numBlocks > numFileSupported)
+static int extent_newNode(ExtentTree *t, BlockNo start, BlockNo length)
+{
+    int n;
+    if (t->freeNode != -1)
+    {
+        n = t->freeNode;
+        t->freeNode = t->nodes[n].left;
+    }
+    else
     {
-        numFileSupported += block_size;
-        numBlocks -= 1;
+        if (t->used == t->capacity)
+        {
+            t->capacity *= 2;
+            t->nodes = realloc(t->nodes, sizeof(FreeExtent) * t->capacity);
+        }
+        n = t->used++;
     }
+    // xorshift keeps the treap balanced without touching rand()
+    t->seed ^= t->seed << 13;
+    t->seed ^= t->seed >> 17;
+    t->seed ^= t->seed << 5;
+    FreeExtent *e = t->nodes + n;
+    e->start = start;
+    e->length = length;
+    e->maxLength = length;
+    e->left = e->right = e->sizeLeft = e->sizeRight = -1;
+    e->priority = t->seed;
+    return n;
+}
 
-    // allocate space for entries used for files
-    int dataEntrySize = numBlocks * block_size;
-    int *dataEntries = malloc(sizeof(int) * dataEntrySize);
-    // set default value for file entries to -1
-    for (int i = 0; i < dataEntrySize; i++)
+static void extent_pull(ExtentTree *t, int n)
+{
+    FreeExtent *e = t->nodes + n;
+    e->maxLength = e->length;
+    if (e->left != -1 && t->nodes[e->left].maxLength > e->maxLength)
+    {
+        e->maxLength = t->nodes[e->left].maxLength;
+    }
+    if (e->right != -1 && t->nodes[e->right].maxLength > e->maxLength)
     {
-        dataEntries[i] = -1;
+        e->maxLength = t->nodes[e->right].maxLength;
     }
+}
 
-    // assign block size to each block
-    Block *blocks = malloc(sizeof(Block) * numBlocks);
-    // assign freeblocks all new block pointers to freeblocks
-    Block **freeBlocks = malloc(sizeof(Block *) * numBlocks);
-    // assign entries and index to each block
-    for (int i = 0; i < numBlocks; i++)
+// split the by-start tree into starts below key and the rest
+static void extent_splitStart(ExtentTree *t, int n, BlockNo key, int *l, int *r)
+{
+    if (n == -1)
+    {
+        *l = *r = -1;
+    }
+    else if (t->nodes[n].start < key)
+    {
+        extent_splitStart(t, t->nodes[n].right, key, &t->nodes[n].right, r);
+        extent_pull(t, n);
+        *l = n;
+    }
+    else
     {
-        blocks[i].index = i;
-        blocks[i].entries = (dataEntries + i * block_size);
-        freeBlocks[i] = (blocks + i);
+        extent_splitStart(t, t->nodes[n].left, key, l, &t->nodes[n].left);
+        extent_pull(t, n);
+        *r = n;
     }
+}
 
-    VolumeControlBlock *vcb = malloc(sizeof(VolumeControlBlock));
-    vcb->freeBlocks = freeBlocks;
-    vcb->blockSize = block_size;
-    vcb->freeBlockNum = numBlocks;
+static int extent_mergeStart(ExtentTree *t, int a, int b)
+{
+    if (a == -1 || b == -1)
+    {
+        return a == -1 ? b : a;
+    }
+    if (t->nodes[a].priority > t->nodes[b].priority)
+    {
+        t->nodes[a].right = extent_mergeStart(t, t->nodes[a].right, b);
+        extent_pull(t, a);
+        return a;
+    }
+    t->nodes[b].left = extent_mergeStart(t, a, t->nodes[b].left);
+    extent_pull(t, b);
+    return b;
+}
 
-    store->fileEntrySize = numFileSupported;
-    store->blocks = blocks;
-    store->numBlocks = numBlocks;
-    store->fileEntry = malloc(numFileSupported * sizeof(FileEntry));
-    store->vcb = vcb;
+static int extent_sizeLess(ExtentTree *t, int n, BlockNo length, BlockNo start)
+{
+    FreeExtent *e = t->nodes + n;
+    return e->length < length || (e->length == length && e->start < start);
+}
 
-    for (int i = 0; i < store->fileEntrySize; i++)
+// split the by-size tree into (length, start) below the key and the rest
+static void extent_splitSize(ExtentTree *t, int n, BlockNo length, BlockNo start, int *l, int *r)
+{
+    if (n == -1)
     {
-        store->fileEntry[i].fileName = 0;
-        store->fileEntry[i].allocationType = allocationType;
-        store->fileEntry[i].params[0] = 0;
-        store->fileEntry[i].params[1] = 0;
+        *l = *r = -1;
+    }
+    else if (extent_sizeLess(t, n, length, start))
+    {
+        extent_splitSize(t, t->nodes[n].sizeRight, length, start, &t->nodes[n].sizeRight, r);
+        *l = n;
     }
+    else
+    {
+        extent_splitSize(t, t->nodes[n].sizeLeft, length, start, l, &t->nodes[n].sizeLeft);
+        *r = n;
+    }
+}
 
-    return store;
+static int extent_mergeSize(ExtentTree *t, int a, int b)
+{
+    if (a == -1 || b == -1)
+    {
+        return a == -1 ? b : a;
+    }
+    if (t->nodes[a].priority > t->nodes[b].priority)
+    {
+        t->nodes[a].sizeRight = extent_mergeSize(t, t->nodes[a].sizeRight, b);
+        return a;
+    }
+    t->nodes[b].sizeLeft = extent_mergeSize(t, a, t->nodes[b].sizeLeft);
+    return b;
 }
 
-void freeStore(Store *store)
+void extent_insert(ExtentTree *t, BlockNo start, BlockNo length)
 {
-    free(store->vcb->freeBlocks);
-    free(store->vcb);
-    free(store->blocks[0].entries);
-    free(store->blocks);
-    free(store->fileEntry);
+    int n = extent_newNode(t, start, length);
+    int l, r;
+    extent_splitStart(t, t->byStart, start, &l, &r);
+    t->byStart = extent_mergeStart(t, extent_mergeStart(t, l, n), r);
+    extent_splitSize(t, t->bySize, length, start, &l, &r);
+    t->bySize = extent_mergeSize(t, extent_mergeSize(t, l, n), r);
+    t->count++;
+    t->lengthCounts[extent_bucket(length)]++;
 }
 
-Block *store_getBlock(Store *store, int index)
+void extent_remove(ExtentTree *t, int n)
 {
-    return store->blocks + index;
+    BlockNo start = t->nodes[n].start;
+    BlockNo length = t->nodes[n].length;
+    int l, m, r;
+    extent_splitStart(t, t->byStart, start, &l, &r);
+    extent_splitStart(t, r, start + 1, &m, &r);
+    t->byStart = extent_mergeStart(t, l, r);
+    extent_splitSize(t, t->bySize, length, start, &l, &r);
+    extent_splitSize(t, r, length, start + 1, &m, &r);
+    t->bySize = extent_mergeSize(t, l, r);
+    t->nodes[n].left = t->freeNode;
+    t->freeNode = n;
+    t->count--;
+    t->lengthCounts[extent_bucket(length)]--;
 }
 
-void block_clear(Block *block, int blockSize)
+// counts the extents of the subtree by length again, for a tree mounted from an image
+void extent_recount(ExtentTree *t, int n)
 {
-    for (int i = 0; i < blockSize; i++)
+    if (n == -1)
     {
-        block->entries[i] = -1;
+        return;
     }
+    t->lengthCounts[extent_bucket(t->nodes[n].length)]++;
+    extent_recount(t, t->nodes[n].left);
+    extent_recount(t, t->nodes[n].right);
 }
 
-void vcb_freeBlock(VolumeControlBlock *vcb, Block *block)
+static void buddy_push(BuddyAllocator *buddy, BlockNo start, int order)
 {
-    block_clear(block, vcb->blockSize);
-    vcb->freeBlocks[block->index] = block;
-    vcb->freeBlockNum += 1;
+    BlockNo head = buddy->heads[order];
+    buddy->next[start] = head;
+    buddy->prev[start] = -1;
+    if (head != -1)
+    {
+        buddy->prev[head] = start;
+    }
+    buddy->heads[order] = start;
+    buddy->order[start] = order;
 }
 
-void vcb_useBlock(VolumeControlBlock *vcb, int index)
+static void buddy_unlink(BuddyAllocator *buddy, BlockNo start)
 {
-    vcb->freeBlocks[index] = NULL;
-    vcb->freeBlockNum -= 1;
+    int order = buddy->order[start];
+    BlockNo p = buddy->prev[start];
+    BlockNo n = buddy->next[start];
+    if (p != -1)
+    {
+        buddy->next[p] = n;
+    }
+    else
+    {
+        buddy->heads[order] = n;
+    }
+    if (n != -1)
+    {
+        buddy->prev[n] = p;
+    }
+    buddy->order[start] = -1;
 }
 
-Block *store_findFreeBlock(Store *store)
+// splits a free range into the largest aligned runs that fit it
+static void buddy_addRange(BuddyAllocator *buddy, BlockNo start, BlockNo length)
 {
-    VolumeControlBlock *vcb = store->vcb;
-    for (int i = 0; i < store->numBlocks; i++)
+    BlockNo end = start + length;
+    while (start < end)
     {
-        if (vcb->freeBlocks[i] != NULL)
+        int order = start == 0 ? BUDDY_ORDERS - 1 : __builtin_ctzll(start);
+        if (order > BUDDY_ORDERS - 1)
+        {
+            order = BUDDY_ORDERS - 1;
+        }
+        while ((1LL << order) > end - start)
         {
-            printf("B%d found in %d traversals\n", vcb->freeBlocks[i]->index, i + 1);
-            return vcb->freeBlocks[i];
+            order--;
         }
+        buddy_push(buddy, start, order);
+        start += 1LL << order;
     }
-    return NULL;
 }
 
-FileEntry *store_findFreeFileEntry(Store *store)
+static void buddy_addExtents(BuddyAllocator *buddy, ExtentTree *t, int n)
 {
-    for (int i = 0; i < store->fileEntrySize; i++)
+    if (n == -1)
     {
-        if (store->fileEntry[i].fileName == 0)
+        return;
+    }
+    buddy_addExtents(buddy, t, t->nodes[n].left);
+    buddy_addRange(buddy, t->nodes[n].start, t->nodes[n].length);
+    buddy_addExtents(buddy, t, t->nodes[n].right);
+}
+
+// free lists over the free extents of the volume, so formatting and mounting build them the same way
+BuddyAllocator *buddy_create(VolumeControlBlock *vcb)
+{
+    BuddyAllocator *buddy = malloc(sizeof(BuddyAllocator));
+    buddy->numBlocks = vcb->numBlocks;
+    for (int k = 0; k < BUDDY_ORDERS; k++)
+    {
+        buddy->heads[k] = -1;
+    }
+    buddy->next = malloc(sizeof(BlockNo) * vcb->numBlocks);
+    buddy->prev = malloc(sizeof(BlockNo) * vcb->numBlocks);
+    buddy->order = malloc(vcb->numBlocks);
+    memset(buddy->order, 0xff, vcb->numBlocks);
+    buddy->splits = 0;
+    buddy->merges = 0;
+    buddy_addExtents(buddy, &vcb->extents, vcb->extents.byStart);
+    return buddy;
+}
+
+void buddy_destroy(BuddyAllocator *buddy)
+{
+    if (buddy == NULL)
+    {
+        return;
+    }
+    free(buddy->next);
+    free(buddy->prev);
+    free(buddy->order);
+    free(buddy);
+}
+
+// start of a run of count blocks rounded up to a power of two, or -1
+// count becomes the rounded size, visits the free lists looked at
+BlockNo buddy_allocate(BuddyAllocator *buddy, BlockNo *count, BlockNo *visits)
+{
+    int order = 0;
+    while ((1LL << order) < *count)
+    {
+        order++;
+    }
+    *count = 1LL << order;
+    int k = order;
+    while (k < BUDDY_ORDERS && buddy->heads[k] == -1)
+    {
+        k++;
+    }
+    *visits += k - order + 1;
+    if (k == BUDDY_ORDERS)
+    {
+        return -1;
+    }
+    BlockNo start = buddy->heads[k];
+    buddy_unlink(buddy, start);
+    // give back the upper half until the run is the size asked for
+    while (k > order)
+    {
+        k--;
+        buddy_push(buddy, start + (1LL << k), k);
+        buddy->splits++;
+    }
+    return start;
+}
+
+// returns a run from buddy_allocate, merging it with its free buddy as far as it goes
+void buddy_release(BuddyAllocator *buddy, BlockNo start, BlockNo count)
+{
+    int order = __builtin_ctzll(count);
+    while (order < BUDDY_ORDERS - 1)
+    {
+        BlockNo other = start ^ (1LL << order);
+        if (other >= buddy->numBlocks || buddy->order[other] != order)
         {
-            return store->fileEntry + i;
+            break;
         }
+        buddy_unlink(buddy, other);
+        start = start < other ? start : other;
+        order++;
+        buddy->merges++;
     }
-    return NULL;
+    buddy_push(buddy, start, order);
 }
 
-void store_add(Store *s, int allocationType, int fileName, int fileSize, int *fileContents)
+// doubles a run from buddy_allocate in place, taking its upper buddies while they are free, until it holds wanted blocks
+// returns the new size, or count when the buddies on the way are not all free and nothing was taken
+BlockNo buddy_extend(BuddyAllocator *buddy, BlockNo start, BlockNo count, BlockNo wanted)
 {
-    //if file exists then then don't add
-    int exists = 0;
-    for (int i = 0; i < s->fileEntrySize; i++)
+    BlockNo size = count;
+    while (size < wanted)
     {
-        if (s->fileEntry[i].fileName == fileName)
+        BlockNo other = start + size;
+        if ((start & size) != 0 || other >= buddy->numBlocks || buddy->order[other] != __builtin_ctzll(size))
         {
-            exists = 1;
-            break;
+            return count;
         }
+        size *= 2;
+    }
+    for (; count < size; count *= 2)
+    {
+        buddy_unlink(buddy, start + count);
+        buddy->merges++;
     }
+    return count;
+}
 
-    if (exists)
+// extent holding block, or -1 when the block is in use
+int extent_findContaining(ExtentTree *t, BlockNo block)
+{
+    int n = t->byStart;
+    while (n != -1)
     {
-        printf("File %d already exists\n", fileName);
+        FreeExtent *e = t->nodes + n;
+        if (block < e->start)
+        {
+            n = e->left;
+        }
+        else if (block >= e->start + e->length)
+        {
+            n = e->right;
+        }
+        else
+        {
+            return n;
+        }
     }
-    else
+    return -1;
+}
+
+// first extent starting at or after block, or -1
+static int extent_findFrom(ExtentTree *t, BlockNo block)
+{
+    int n = t->byStart;
+    int found = -1;
+    while (n != -1)
     {
-        if (allocationType == ALLOC_CONTIGUOUS)
+        if (t->nodes[n].start >= block)
         {
-            // find the blocks required
-            int blocksRequired = fileSize / s->vcb->blockSize;
+            found = n;
+            n = t->nodes[n].left;
+        }
+        else
+        {
+            n = t->nodes[n].right;
+        }
+    }
+    return found;
+}
 
-            // round up the blocks required
-            if (fileSize % s->vcb->blockSize > 0)
+// pick an extent of at least count blocks under the policy, visits counts nodes touched
+int extent_findFit(ExtentTree *t, BlockNo count, int policy, BlockNo *visits)
+{
+    int n;
+    int found = -1;
+    *visits = 0;
+    if (policy == FIT_FIRST)
+    {
+        // lowest start whose subtree still holds a long enough extent
+        n = t->byStart;
+        while (n != -1 && t->nodes[n].maxLength >= count)
+        {
+            FreeExtent *e = t->nodes + n;
+            (*visits)++;
+            if (e->left != -1 && t->nodes[e->left].maxLength >= count)
             {
-                blocksRequired++;
+                n = e->left;
             }
-
-            //if file size is too big, return
-            if (s->vcb->freeBlockNum < blocksRequired)
+            else if (e->length >= count)
             {
-                printf("\nFile size too big");
-                return;
+                return n;
             }
-
-            int temp = 0;
-            int i = 0;
-            int count = 0;
-
-            //find the index of the free block
-            for (i = 0; i < s->numBlocks; ++i)
+            else
             {
-                if (s->vcb->freeBlocks[i] != NULL)
-                {
-                    count++;
-                    //if found the right file size, break
-                    if (count >= blocksRequired)
-                    {
-                        break;
-                    }
-                }
-                if (s->vcb->freeBlocks[i] == NULL)
-                {
-                    count = 0;
-                }
+                n = e->right;
             }
-            printf("%d Traversals to find blocks\n", i);
-            if (count < blocksRequired)
+        }
+        return -1;
+    }
+    n = t->bySize;
+    while (n != -1)
+    {
+        (*visits)++;
+        if (policy == FIT_BEST)
+        {
+            // smallest extent that is long enough
+            if (t->nodes[n].length >= count)
             {
-                printf("No contiguous space found");
-                return;
+                found = n;
+                n = t->nodes[n].sizeLeft;
             }
-
-            temp = i;
-            // i refers to the index of the block where the file is to be inserted
-            i -= blocksRequired - 1;
-
-            printf("Adding file %d and found free ", fileName);
-            //allocate the blocks
-            for (int j = 0; j <= blocksRequired; ++j)
+            else
             {
-                vcb_useBlock(s->vcb, i + j);
-                printf("B%d ", i + j);
+                n = t->nodes[n].sizeRight;
             }
-            printf("\n");
+        }
+        else
+        {
+            found = n;
+            n = t->nodes[n].sizeRight;
+        }
+    }
+    if (found != -1 && t->nodes[found].length < count)
+    {
+        return -1;
+    }
+    return found;
+}
 
-            int prevBlock = -1;
-            printf("Adding file%d at", fileName);
-            for (int j = 0; j < fileSize; ++j)
-            {
-                int blockOffset = j / s->vcb->blockSize;
+ContentIndex *contentIndex_create()
+{
+    ContentIndex *index = malloc(sizeof(ContentIndex));
+    index->mask = 1023;
+    index->count = 0;
+    index->slots = calloc(index->mask + 1, sizeof(ContentPosting));
+    return index;
+}
 
-                if (prevBlock != blockOffset)
-                {
-                    if (prevBlock != -1)
-                    {
-                        printf(")");
-                    }
-                    printf(" B%d(", i + blockOffset);
-                    prevBlock = blockOffset;
-                }
-                s->blocks[i + blockOffset].entries[j % s->vcb->blockSize] = fileContents[j];
-                printf("%d ", fileContents[j]);
-            }
-            if (fileSize == 0)
-            {
-                printf(" B%d(", i);
-            }
-            printf(")\n");
+void contentIndex_free(ContentIndex *index)
+{
+    if (index != NULL)
+    {
+        free(index->slots);
+        free(index);
+    }
+}
 
-            //allocate the file entry appropriately
-            for (int k = 0; k < s->fileEntrySize; ++k)
+static size_t content_hash(int value)
+{
+    return (size_t)(((uint64_t)(unsigned int)value * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+static void contentIndex_place(ContentIndex *index, ContentPosting posting)
+{
+    size_t pos = content_hash(posting.value) & index->mask;
+    while (index->slots[pos].owner != 0)
+    {
+        pos = (pos + 1) & index->mask;
+    }
+    index->slots[pos] = posting;
+}
+
+// record that owner wrote value into block
+void contentIndex_add(ContentIndex *index, int value, BlockNo block, int owner)
+{
+    // grow at half load so probe runs stay short
+    if (2 * (index->count + 1) > index->mask + 1)
+    {
+        ContentPosting *old = index->slots;
+        size_t oldSize = index->mask + 1;
+        index->mask = 2 * oldSize - 1;
+        index->slots = calloc(2 * oldSize, sizeof(ContentPosting));
+        for (size_t i = 0; i < oldSize; i++)
+        {
+            if (old[i].owner != 0)
             {
-                if (s->fileEntry[k].fileName == 0)
+                contentIndex_place(index, old[i]);
+            }
+        }
+        free(old);
+    }
+    ContentPosting posting = {value, owner, block};
+    contentIndex_place(index, posting);
+    index->count++;
+}
+
+// first posting for value, or NULL
+ContentPosting *contentIndex_find(ContentIndex *index, int value)
+{
+    size_t pos = content_hash(value) & index->mask;
+    while (index->slots[pos].owner != 0)
+    {
+        if (index->slots[pos].value == value)
+        {
+            return index->slots + pos;
+        }
+        pos = (pos + 1) & index->mask;
+    }
+    return NULL;
+}
+
+// drop one posting of value in block by owner, if there is one
+void contentIndex_remove(ContentIndex *index, int value, BlockNo block, int owner)
+{
+    size_t mask = index->mask;
+    size_t hole = content_hash(value) & mask;
+    while (index->slots[hole].owner != 0 && (index->slots[hole].value != value || index->slots[hole].block != block || index->slots[hole].owner != owner))
+    {
+        hole = (hole + 1) & mask;
+    }
+    if (index->slots[hole].owner == 0)
+    {
+        return;
+    }
+    index->slots[hole].owner = 0;
+    index->count--;
+    // backward shift the rest of the probe run
+    for (size_t pos = (hole + 1) & mask; index->slots[pos].owner != 0; pos = (pos + 1) & mask)
+    {
+        size_t home = content_hash(index->slots[pos].value) & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask))
+        {
+            index->slots[hole] = index->slots[pos];
+            index->slots[pos].owner = 0;
+            hole = pos;
+        }
+    }
+}
+
+DedupIndex *dedup_create(BlockNo numBlocks)
+{
+    DedupIndex *index = malloc(sizeof(DedupIndex));
+    index->mask = 1023;
+    index->count = 0;
+    index->slots = malloc(sizeof(DedupSlot) * (index->mask + 1));
+    memset(index->slots, 0xff, sizeof(DedupSlot) * (index->mask + 1));
+    index->refs = calloc(numBlocks, sizeof(int));
+    index->written = 0;
+    index->shared = 0;
+    index->unshared = 0;
+    return index;
+}
+
+void dedup_free(DedupIndex *index)
+{
+    if (index != NULL)
+    {
+        free(index->slots);
+        free(index->refs);
+        free(index);
+    }
+}
+
+// FNV-1a over the entries of a block, empty entries included
+// and over the width they are packed at, so a packed block never matches a plain one with the same words
+static uint64_t dedup_fingerprint(const int *entries, int blockSize, int packedBits)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    for (int i = 0; i < blockSize; i++)
+    {
+        hash = (hash ^ (uint32_t)entries[i]) * 1099511628211ULL;
+    }
+    return (hash ^ (uint32_t)packedBits) * 1099511628211ULL;
+}
+
+static void dedup_place(DedupIndex *index, DedupSlot slot)
+{
+    size_t pos = slot.fingerprint & index->mask;
+    while (index->slots[pos].block != -1)
+    {
+        pos = (pos + 1) & index->mask;
+    }
+    index->slots[pos] = slot;
+}
+
+// record that block holds content with fingerprint
+void dedup_add(DedupIndex *index, uint64_t fingerprint, BlockNo block)
+{
+    // grow at half load so probe runs stay short
+    if (2 * (index->count + 1) > index->mask + 1)
+    {
+        DedupSlot *old = index->slots;
+        size_t oldSize = index->mask + 1;
+        index->mask = 2 * oldSize - 1;
+        index->slots = malloc(sizeof(DedupSlot) * 2 * oldSize);
+        memset(index->slots, 0xff, sizeof(DedupSlot) * 2 * oldSize);
+        for (size_t i = 0; i < oldSize; i++)
+        {
+            if (old[i].block != -1)
+            {
+                dedup_place(index, old[i]);
+            }
+        }
+        free(old);
+    }
+    DedupSlot slot = {fingerprint, block};
+    dedup_place(index, slot);
+    index->count++;
+}
+
+// drop block from the index, if it is there
+void dedup_remove(DedupIndex *index, uint64_t fingerprint, BlockNo block)
+{
+    size_t mask = index->mask;
+    size_t hole = fingerprint & mask;
+    while (index->slots[hole].block != -1 && index->slots[hole].block != block)
+    {
+        hole = (hole + 1) & mask;
+    }
+    if (index->slots[hole].block == -1)
+    {
+        return;
+    }
+    index->slots[hole].block = -1;
+    index->count--;
+    // backward shift the rest of the probe run
+    for (size_t pos = (hole + 1) & mask; index->slots[pos].block != -1; pos = (pos + 1) & mask)
+    {
+        size_t home = index->slots[pos].fingerprint & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask))
+        {
+            index->slots[hole] = index->slots[pos];
+            index->slots[pos].block = -1;
+            hole = pos;
+        }
+    }
+}
+
+// derive the geometry the way a fixed volume of entrySize entries is split:
+// whatever is not used by blocks holds file entries, with more entries than blocks
+VolumeGeometry geometry_fromEntries(long long entrySize, int block_size)
+{
+    VolumeGeometry geometry;
+    long long leftovers = entrySize % block_size;
+    long long numBlocks = entrySize / block_size;
+    long long numFileSupported = leftovers - 1;
+
+    // calculate supported number of files such that supported > block,
+    // every block given up adds block_size entries to the directory
+    if (numBlocks > numFileSupported)
+    {
+        long long moved = (numBlocks - numFileSupported + block_size) / (block_size + 1);
+        numFileSupported += moved * block_size;
+        numBlocks -= moved;
+    }
+
+    geometry.blockSize = block_size;
+    geometry.numBlocks = numBlocks;
+    geometry.fileEntrySize = numFileSupported;
+    return geometry;
+}
+
+// largest volume the linked layouts can address, next pointers live in int entries
+#define MAX_BLOCKS 2147483647LL
+
+static int geometry_valid(VolumeGeometry geometry)
+{
+    return geometry.blockSize >= 2 && geometry.numBlocks >= 1 && geometry.numBlocks <= MAX_BLOCKS &&
+           geometry.fileEntrySize >= 1 && geometry.fileEntrySize <= (1 << 29);
+}
+
+// keep the directory index at most half full
+static int dir_tableSize(int fileEntrySize)
+{
+    int dirTableSize = 1;
+    while (dirTableSize < 2 * fileEntrySize)
+    {
+        dirTableSize *= 2;
+    }
+    return dirTableSize;
+}
+
+// store and volume control block, the arrays are attached by the caller
+static Store *store_new(VolumeGeometry geometry)
+{
+    VolumeControlBlock *vcb = malloc(sizeof(VolumeControlBlock));
+    vcb->blockSize = geometry.blockSize;
+    vcb->numBlocks = geometry.numBlocks;
+    vcb->freeMapWords = (geometry.numBlocks + FREEMAP_WORD_BITS - 1) / FREEMAP_WORD_BITS;
+    vcb->journal = NULL;
+    vcb->snapshots = NULL;
+
+    Store *store = malloc(sizeof(Store));
+    store->vcb = vcb;
+    store->fileEntrySize = geometry.fileEntrySize;
+    store->dirTableMask = dir_tableSize(geometry.fileEntrySize) - 1;
+    store->numBlocks = geometry.numBlocks;
+    store->contentIndex = NULL;
+    store->dedup = NULL;
+    store->compress = 0;
+    store->packedFiles = 0;
+    store->packedSaved = 0;
+    store->unpackedFiles = 0;
+    store->output.verbose = 1;
+    store->output.text = stdout;
+    store->output.eventFile = NULL;
+    store->output.events = NULL;
+    store->output.eventCount = 0;
+    store->traversals = 0;
+    store->reads = 0;
+    for (int i = 0; i < CURSOR_SLOTS; i++)
+    {
+        store->cursors[i].fileName = 0;
+    }
+    store->cache = NULL;
+    store->device = NULL;
+    store->defragMoves = 0;
+    store->defragFiles = 0;
+    store->blockOwners = NULL;
+    memset(&store->metrics, 0, sizeof(VolumeMetrics));
+    store->buddy = NULL;
+    store->locks = NULL;
+    store->fat = NULL;
+    store->image = NULL;
+    store->imageSize = 0;
+    store->delayed = NULL;
+    store->batchStart = 0;
+    store->batchLeft = 0;
+    store->view = NULL;
+    return store;
+}
+
+// empty volume in the arrays the store points at, the extent tree must be initialised
+static void store_format(Store *store, int allocationType)
+{
+    VolumeControlBlock *vcb = store->vcb;
+    BlockNo numBlocks = store->numBlocks;
+
+    // set default value for file entries to -1
+    memset(store->data, 0xff, sizeof(int) * (size_t)numBlocks * vcb->blockSize);
+
+    // mark every block free, bits past numBlocks stay cleared
+    for (BlockNo i = 0; i < vcb->freeMapWords; i++)
+    {
+        vcb->freeMap[i] = i < numBlocks / FREEMAP_WORD_BITS ? ~0ULL : 0;
+    }
+    if (numBlocks % FREEMAP_WORD_BITS > 0)
+    {
+        vcb->freeMap[vcb->freeMapWords - 1] = (1ULL << (numBlocks % FREEMAP_WORD_BITS)) - 1;
+    }
+    extent_insert(&vcb->extents, 0, numBlocks);
+    if (store->fat != NULL)
+    {
+        memset(store->fat, 0xff, sizeof(int) * numBlocks);
+    }
+    vcb->fitPolicy = FIT_FIRST;
+    vcb->freeMapHint = 0;
+    vcb->freeBlockNum = numBlocks;
+
+    for (int i = 0; i < store->fileEntrySize; i++)
+    {
+        store->fileEntry[i].fileName = 0;
+        store->fileEntry[i].allocationType = allocationType;
+        store->fileEntry[i].params[0] = 0;
+        store->fileEntry[i].params[1] = 0;
+        store->fileEntry[i].fileSize = 0;
+        store->fileEntry[i].packedBits = 0;
+    }
+    for (int i = 0; i <= store->dirTableMask; i++)
+    {
+        store->dirTable[i] = -1;
+    }
+    // lowest slot on top so entries are handed out in order
+    store->freeSlotCount = store->fileEntrySize;
+    for (int i = 0; i < store->fileEntrySize; i++)
+    {
+        store->freeSlots[i] = store->fileEntrySize - 1 - i;
+    }
+    if (allocationType == ALLOC_BUDDY)
+    {
+        store->buddy = buddy_create(vcb);
+    }
+}
+
+// returns NULL when the geometry cannot be represented or allocated
+Store *createStore(VolumeGeometry geometry, int allocationType)
+{
+    if (!geometry_valid(geometry))
+    {
+        return NULL;
+    }
+
+    // allocate space for entries used for files
+    int *dataEntries = malloc(sizeof(int) * (size_t)geometry.numBlocks * geometry.blockSize);
+    if (dataEntries == NULL)
+    {
+        return NULL;
+    }
+
+    Store *store = store_new(geometry);
+    store->data = dataEntries;
+    store->vcb->freeMap = malloc(sizeof(uint64_t) * store->vcb->freeMapWords);
+    extent_init(&store->vcb->extents);
+    store->fileEntry = malloc(geometry.fileEntrySize * sizeof(FileEntry));
+    store->dirTable = malloc(sizeof(int) * (store->dirTableMask + 1));
+    store->freeSlots = malloc(sizeof(int) * geometry.fileEntrySize);
+    store_format(store, allocationType);
+    return store;
+}
+
+static size_t image_align(size_t size)
+{
+    return (size + IMAGE_ALIGN - 1) & ~(size_t)(IMAGE_ALIGN - 1);
+}
+
+// places every section of an image for the geometry, one after the other
+static void image_layout(ImageHeader *h, VolumeGeometry geometry, int useFat)
+{
+    h->blockSize = geometry.blockSize;
+    h->fileEntrySize = geometry.fileEntrySize;
+    h->numBlocks = geometry.numBlocks;
+    h->dirTableMask = dir_tableSize(geometry.fileEntrySize) - 1;
+    // free extents are separated by used blocks, so there are never more than half as many
+    h->extentCapacity = geometry.numBlocks / 2 + 2;
+
+    size_t offset = image_align(sizeof(ImageHeader));
+    h->fileEntryOffset = offset;
+    offset += image_align(sizeof(FileEntry) * (size_t)h->fileEntrySize);
+    h->dirTableOffset = offset;
+    offset += image_align(sizeof(int) * ((size_t)h->dirTableMask + 1));
+    h->freeSlotsOffset = offset;
+    offset += image_align(sizeof(int) * (size_t)h->fileEntrySize);
+    h->freeMapOffset = offset;
+    offset += image_align(sizeof(uint64_t) * (size_t)((geometry.numBlocks + FREEMAP_WORD_BITS - 1) / FREEMAP_WORD_BITS));
+    h->extentOffset = offset;
+    offset += image_align(sizeof(FreeExtent) * (size_t)h->extentCapacity);
+    h->fatOffset = useFat ? offset : 0;
+    offset += useFat ? image_align(sizeof(int) * (size_t)geometry.numBlocks) : 0;
+    h->dataOffset = offset;
+    offset += image_align(sizeof(int) * (size_t)geometry.numBlocks * geometry.blockSize);
+    h->size = offset;
+}
+
+// maps the whole image file, NULL when it cannot be opened
+static ImageHeader *image_map(const char *path, int flags, size_t *size)
+{
+    int fd = open(path, flags, 0644);
+    if (fd == -1)
+    {
+        return NULL;
+    }
+    if (flags & O_CREAT)
+    {
+        if (ftruncate(fd, *size) != 0)
+        {
+            close(fd);
+            return NULL;
+        }
+    }
+    else
+    {
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(ImageHeader))
+        {
+            close(fd);
+            return NULL;
+        }
+        *size = st.st_size;
+    }
+    void *image = mmap(NULL, *size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return image == MAP_FAILED ? NULL : image;
+}
+
+// points the store's arrays into the mapped image
+static void store_attachImage(Store *store, ImageHeader *h)
+{
+    char *base = (char *)h;
+    store->image = h;
+    store->imageSize = h->size;
+    store->fileEntry = (FileEntry *)(base + h->fileEntryOffset);
+    store->dirTable = (int *)(base + h->dirTableOffset);
+    store->freeSlots = (int *)(base + h->freeSlotsOffset);
+    store->vcb->freeMap = (uint64_t *)(base + h->freeMapOffset);
+    store->data = (int *)(base + h->dataOffset);
+    store->fat = h->fatOffset != 0 ? (int *)(base + h->fatOffset) : NULL;
+    // sized for the worst case, so the tree never has to grow out of the image
+    store->vcb->extents.nodes = (FreeExtent *)(base + h->extentOffset);
+    store->vcb->extents.capacity = h->extentCapacity;
+}
+
+// remember that a unit of a journaled section changed, its bytes are logged at the next commit
+static void journal_note(Journal *j, int section, int64_t unit)
+{
+    if (j == NULL)
+    {
+        return;
+    }
+    JournalSection *sec = j->sections + section;
+    uint64_t bit = 1ULL << (unit % 64);
+    if ((sec->dirty[unit / 64] & bit) == 0)
+    {
+        sec->dirty[unit / 64] |= bit;
+        sec->units[sec->count++] = unit;
+    }
+}
+
+static size_t journal_pad(size_t length)
+{
+    return (length + 7) & ~(size_t)7;
+}
+
+// FNV-1a over the header fields and the records a word at a time, the records are padded to whole words
+static uint64_t journal_checksum(const JournalCommit *c, const char *records)
+{
+    uint64_t hash = 14695981039346656037ULL;
+    uint64_t fields[3] = {c->records, c->sequence, c->bytes};
+    for (int i = 0; i < 3; i++)
+    {
+        hash = (hash ^ fields[i]) * 1099511628211ULL;
+    }
+    for (uint64_t i = 0; i + 8 <= c->bytes; i += 8)
+    {
+        uint64_t word;
+        memcpy(&word, records + i, 8);
+        hash = (hash ^ word) * 1099511628211ULL;
+    }
+    return hash;
+}
+
+static int journal_writeAll(int fd, const char *bytes, size_t length, off_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t n = pwrite(fd, bytes, length, offset);
+        if (n <= 0)
+        {
+            return 0;
+        }
+        bytes += n;
+        length -= n;
+        offset += n;
+    }
+    return 1;
+}
+
+// the image file holds every commit once it is synced, so the journal can start over
+static int journal_checkpoint(Journal *j)
+{
+    if (fdatasync(j->imageFd) != 0 || ftruncate(j->fd, 0) != 0 || fsync(j->fd) != 0)
+    {
+        return 0;
+    }
+    j->size = 0;
+    j->sequence = 0;
+    j->checkpoints++;
+    return 1;
+}
+
+// logs the units changed since the last commit as one group and syncs the journal, only then are they written to the image file
+// returns 0 when the journal or the image could not be written
+int journal_commit(Journal *j)
+{
+    j->pendingOps = 0;
+    size_t bytes = 0;
+    uint32_t records = 0;
+    for (int i = 0; i < JOURNAL_SECTIONS; i++)
+    {
+        JournalSection *sec = j->sections + i;
+        bytes += sec->count * (sizeof(JournalRecord) + journal_pad(sec->unitSize));
+        records += sec->count;
+    }
+    if (records == 0 || j->failed)
+    {
+        return !j->failed;
+    }
+    size_t total = sizeof(JournalCommit) + bytes;
+    if (total > j->bufferCapacity)
+    {
+        j->buffer = realloc(j->buffer, total);
+        j->bufferCapacity = total;
+    }
+    char *out = j->buffer + sizeof(JournalCommit);
+    for (int i = 0; i < JOURNAL_SECTIONS; i++)
+    {
+        JournalSection *sec = j->sections + i;
+        for (int64_t u = 0; u < sec->count; u++)
+        {
+            JournalRecord record = {sec->offset + sec->units[u] * sec->unitSize, sec->unitSize};
+            memcpy(out, &record, sizeof(record));
+            out += sizeof(record);
+            memcpy(out, j->base + record.offset, record.length);
+            memset(out + record.length, 0, journal_pad(record.length) - record.length);
+            out += journal_pad(record.length);
+        }
+    }
+    JournalCommit commit = {JOURNAL_MAGIC, records, j->sequence + 1, bytes, 0};
+    commit.checksum = journal_checksum(&commit, j->buffer + sizeof(JournalCommit));
+    memcpy(j->buffer, &commit, sizeof(commit));
+    int ok = journal_writeAll(j->fd, j->buffer, total, j->size) && fdatasync(j->fd) == 0;
+
+    for (int i = 0; i < JOURNAL_SECTIONS; i++)
+    {
+        JournalSection *sec = j->sections + i;
+        for (int64_t u = 0; u < sec->count; u++)
+        {
+            uint64_t offset = sec->offset + sec->units[u] * sec->unitSize;
+            ok = ok && journal_writeAll(j->imageFd, j->base + offset, sec->unitSize, offset);
+            sec->dirty[sec->units[u] / 64] = 0;
+        }
+        sec->count = 0;
+    }
+    j->sequence++;
+    j->size += total;
+    j->commits++;
+    j->records += records;
+    j->bytes += total;
+    if (ok && j->size >= JOURNAL_CHECKPOINT_BYTES)
+    {
+        ok = journal_checkpoint(j);
+    }
+    j->failed = !ok;
+    return ok;
+}
+
+// one more change to the volume, committed with the rest of its group
+static void journal_endOp(Journal *j)
+{
+    if (j == NULL)
+    {
+        return;
+    }
+    j->operations++;
+    if (++j->pendingOps >= j->groupOps)
+    {
+        journal_commit(j);
+    }
+}
+
+// applies the committed groups of the journal at path to a mapped image, stopping at the first torn or damaged one
+// returns the number of groups applied
+static long long journal_replay(ImageHeader *h, const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    struct stat st;
+    uint64_t remaining = fstat(fileno(f), &st) == 0 ? st.st_size : 0;
+    long long groups = 0;
+    char *records = NULL;
+    JournalCommit commit;
+    while (remaining >= sizeof(commit) && fread(&commit, sizeof(commit), 1, f) == 1)
+    {
+        remaining -= sizeof(commit);
+        if (commit.magic != JOURNAL_MAGIC || commit.sequence != (uint64_t)groups + 1 || commit.bytes > remaining)
+        {
+            break;
+        }
+        records = realloc(records, commit.bytes + 1);
+        if (fread(records, 1, commit.bytes, f) != commit.bytes || journal_checksum(&commit, records) != commit.checksum)
+        {
+            break;
+        }
+        remaining -= commit.bytes;
+        // every record must land after the header and inside the image before any is applied
+        int ok = 1;
+        uint64_t at = 0;
+        for (uint32_t r = 0; r < commit.records && ok; r++)
+        {
+            JournalRecord record;
+            ok = at + sizeof(record) <= commit.bytes;
+            if (ok)
+            {
+                memcpy(&record, records + at, sizeof(record));
+                at += sizeof(record);
+                ok = record.offset >= h->fileEntryOffset && record.length <= h->size && record.offset <= h->size - record.length &&
+                     journal_pad(record.length) <= commit.bytes - at;
+                at += ok ? journal_pad(record.length) : 0;
+            }
+        }
+        if (!ok || at != commit.bytes)
+        {
+            break;
+        }
+        for (at = 0; at < commit.bytes;)
+        {
+            JournalRecord record;
+            memcpy(&record, records + at, sizeof(record));
+            at += sizeof(record);
+            memcpy((char *)h + record.offset, records + at, record.length);
+            at += journal_pad(record.length);
+        }
+        groups++;
+    }
+    free(records);
+    fclose(f);
+    return groups;
+}
+
+static void journal_section(Journal *j, int section, uint64_t offset, size_t unitSize, int64_t unitCount)
+{
+    JournalSection *sec = j->sections + section;
+    sec->offset = offset;
+    sec->unitSize = unitSize;
+    sec->unitCount = unitCount;
+    sec->dirty = calloc((unitCount + 63) / 64 + 1, sizeof(uint64_t));
+    sec->units = malloc(sizeof(int64_t) * (unitCount + 1));
+    sec->count = 0;
+}
+
+// keeps the image at imagePath with a journal at path, committing every groupOps changes
+// the image is synced and mapped again privately, so nothing reaches the file without being in the journal first
+// returns 0 when the journal or the image cannot be opened
+int store_openJournal(Store *store, const char *imagePath, const char *path, int groupOps)
+{
+    ImageHeader *h = store->image;
+    if (msync(h, store->imageSize, MS_SYNC) != 0)
+    {
+        return 0;
+    }
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    int imageFd = open(imagePath, O_RDWR);
+    void *mapping = imageFd == -1 ? MAP_FAILED : mmap(NULL, store->imageSize, PROT_READ | PROT_WRITE, MAP_PRIVATE, imageFd, 0);
+    if (fd == -1 || mapping == MAP_FAILED || ftruncate(fd, 0) != 0 || fsync(fd) != 0)
+    {
+        if (mapping != MAP_FAILED)
+        {
+            munmap(mapping, store->imageSize);
+        }
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        if (imageFd != -1)
+        {
+            close(imageFd);
+        }
+        return 0;
+    }
+    munmap(h, store->imageSize);
+    h = mapping;
+    store_attachImage(store, h);
+
+    Journal *j = malloc(sizeof(Journal));
+    j->fd = fd;
+    j->imageFd = imageFd;
+    j->base = mapping;
+    journal_section(j, JOURNAL_FILE_ENTRY, h->fileEntryOffset, sizeof(FileEntry), h->fileEntrySize);
+    journal_section(j, JOURNAL_FREE_MAP, h->freeMapOffset, sizeof(uint64_t), store->vcb->freeMapWords);
+    journal_section(j, JOURNAL_FAT, h->fatOffset, sizeof(int), h->fatOffset != 0 ? h->numBlocks : 0);
+    journal_section(j, JOURNAL_BLOCK, h->dataOffset, sizeof(int) * (size_t)h->blockSize, h->numBlocks);
+    j->groupOps = groupOps;
+    j->pendingOps = 0;
+    j->sequence = 0;
+    j->size = 0;
+    j->buffer = NULL;
+    j->bufferCapacity = 0;
+    j->failed = 0;
+    j->operations = 0;
+    j->commits = 0;
+    j->records = 0;
+    j->bytes = 0;
+    j->checkpoints = 0;
+    store->vcb->journal = j;
+    return 1;
+}
+
+// commits what is left, writes the sections the journal does not cover and marks the image clean,
+// the journal is emptied last so a crash on the way only replays commits already in the image
+static void journal_close(Store *store)
+{
+    Journal *j = store->vcb->journal;
+    ImageHeader *h = store->image;
+    int ok = journal_commit(j);
+    ok = ok && journal_writeAll(j->imageFd, j->base + h->dirTableOffset, h->freeMapOffset - h->dirTableOffset, h->dirTableOffset);
+    uint64_t extentEnd = h->fatOffset != 0 ? h->fatOffset : h->dataOffset;
+    ok = ok && journal_writeAll(j->imageFd, j->base + h->extentOffset, extentEnd - h->extentOffset, h->extentOffset);
+    ok = ok && fdatasync(j->imageFd) == 0;
+    ok = ok && journal_writeAll(j->imageFd, j->base, sizeof(ImageHeader), 0) && fdatasync(j->imageFd) == 0;
+    if (ok)
+    {
+        journal_checkpoint(j);
+    }
+    close(j->fd);
+    close(j->imageFd);
+    for (int i = 0; i < JOURNAL_SECTIONS; i++)
+    {
+        free(j->sections[i].dirty);
+        free(j->sections[i].units);
+    }
+    free(j->buffer);
+    free(j);
+    store->vcb->journal = NULL;
+}
+
+// formats a new image at path, NULL when the geometry or the file is unusable
+// useFat keeps the chains of linked files in a FAT section of the image
+Store *store_createImage(const char *path, VolumeGeometry geometry, int allocationType, int useFat)
+{
+    if (!geometry_valid(geometry))
+    {
+        return NULL;
+    }
+    ImageHeader layout;
+    image_layout(&layout, geometry, useFat);
+    size_t size = layout.size;
+    ImageHeader *h = image_map(path, O_RDWR | O_CREAT | O_TRUNC, &size);
+    if (h == NULL)
+    {
+        return NULL;
+    }
+    *h = layout;
+    h->magic = IMAGE_MAGIC;
+    h->version = IMAGE_VERSION;
+    h->clean = 0;
+    h->allocationType = allocationType;
+
+    Store *store = store_new(geometry);
+    store_attachImage(store, h);
+    ExtentTree *t = &store->vcb->extents;
+    t->used = 0;
+    t->freeNode = -1;
+    t->byStart = -1;
+    t->bySize = -1;
+    t->count = 0;
+    t->seed = 2463534242u;
+    memset(t->lengthCounts, 0, sizeof(t->lengthCounts));
+    store_format(store, allocationType);
+    return store;
+}
+
+// reads the geometry and allocation type of an image, 0 when it is not a usable image
+int image_peek(const char *path, VolumeGeometry *geometry, int *allocationType)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    ImageHeader h;
+    int ok = fread(&h, sizeof(h), 1, f) == 1 && h.magic == IMAGE_MAGIC && h.version == IMAGE_VERSION;
+    fclose(f);
+    if (ok)
+    {
+        geometry->blockSize = h.blockSize;
+        geometry->numBlocks = h.numBlocks;
+        geometry->fileEntrySize = h.fileEntrySize;
+        *allocationType = h.allocationType;
+    }
+    return ok;
+}
+
+// mounts an image in place, nothing is parsed or rebuilt unless it was not closed cleanly
+// with journalPath an unclean image is mounted once the journal's commits are replayed, their count goes to replayed
+void metrics_recount(Store *s);
+void store_rebuildIndexes(Store *s);
+
+Store *store_mountImage(const char *path, const char *journalPath, long long *replayed)
+{
+    size_t size = 0;
+    ImageHeader *h = image_map(path, O_RDWR, &size);
+    if (h == NULL)
+    {
+        return NULL;
+    }
+    // the layout must be exactly the one this build would write for the geometry
+    VolumeGeometry geometry = {h->blockSize, h->numBlocks, h->fileEntrySize};
+    ImageHeader layout;
+    int journaled = journalPath != NULL && access(journalPath, F_OK) == 0;
+    int ok = h->magic == IMAGE_MAGIC && h->version == IMAGE_VERSION && (h->clean == 1 || journaled) && h->size == size && geometry_valid(geometry);
+    if (ok)
+    {
+        image_layout(&layout, geometry, h->fatOffset != 0);
+        ok = memcmp(&layout.fileEntryOffset, &h->fileEntryOffset, sizeof(uint64_t) * 8) == 0 && layout.dirTableMask == h->dirTableMask;
+    }
+    if (!ok)
+    {
+        munmap(h, size);
+        return NULL;
+    }
+
+    *replayed = journaled ? journal_replay(h, journalPath) : 0;
+
+    Store *store = store_new(geometry);
+    store_attachImage(store, h);
+    VolumeControlBlock *vcb = store->vcb;
+    vcb->fitPolicy = h->fitPolicy;
+    if (h->clean == 1 && *replayed == 0)
+    {
+        vcb->freeBlockNum = h->freeBlockNum;
+        vcb->freeMapHint = h->freeMapHint;
+        vcb->extents.used = h->extentUsed;
+        vcb->extents.freeNode = h->extentFreeNode;
+        vcb->extents.byStart = h->extentByStart;
+        vcb->extents.bySize = h->extentBySize;
+        vcb->extents.count = h->extentCount;
+        vcb->extents.seed = h->extentSeed;
+        store->freeSlotCount = h->freeSlotCount;
+        memset(vcb->extents.lengthCounts, 0, sizeof(vcb->extents.lengthCounts));
+        extent_recount(&vcb->extents, vcb->extents.byStart);
+    }
+    else
+    {
+        store_rebuildIndexes(store);
+    }
+    h->clean = 0;
+    // the free lists are not kept in the image, the free extents give them back
+    if (h->allocationType == ALLOC_BUDDY)
+    {
+        store->buddy = buddy_create(vcb);
+    }
+    metrics_recount(store);
+    return store;
+}
+
+// writes the counters back and unmaps, the kernel writes the pages out unless the journal does
+static void store_closeImage(Store *store)
+{
+    ImageHeader *h = store->image;
+    VolumeControlBlock *vcb = store->vcb;
+    h->freeBlockNum = vcb->freeBlockNum;
+    h->freeMapHint = vcb->freeMapHint;
+    h->fitPolicy = vcb->fitPolicy;
+    h->extentUsed = vcb->extents.used;
+    h->extentFreeNode = vcb->extents.freeNode;
+    h->extentByStart = vcb->extents.byStart;
+    h->extentBySize = vcb->extents.bySize;
+    h->extentCount = vcb->extents.count;
+    h->extentSeed = vcb->extents.seed;
+    h->freeSlotCount = store->freeSlotCount;
+    h->clean = 1;
+    if (store->vcb->journal != NULL)
+    {
+        journal_close(store);
+    }
+    munmap(h, store->imageSize);
+}
+
+void store_flushEvents(Store *store)
+{
+    Output *out = &store->output;
+    if (out->eventFile != NULL && out->eventCount > 0)
+    {
+        fwrite(out->events, sizeof(StoreEvent), out->eventCount, out->eventFile);
+    }
+    out->eventCount = 0;
+}
+
+void cache_free(BlockCache *cache);
+void buddy_destroy(BuddyAllocator *buddy);
+void store_disableLocks(Store *store);
+void store_disableDelayedAdds(Store *s);
+void store_dropSnapshots(Store *s);
+
+void freeStore(Store *store)
+{
+    store_disableDelayedAdds(store);
+    store_dropSnapshots(store);
+    store_flushEvents(store);
+    free(store->output.events);
+    cache_free(store->cache);
+    buddy_destroy(store->buddy);
+    store_disableLocks(store);
+    free(store->device);
+    contentIndex_free(store->contentIndex);
+    dedup_free(store->dedup);
+    free(store->blockOwners);
+    if (store->image != NULL)
+    {
+        store_closeImage(store);
+    }
+    else
+    {
+        free(store->vcb->freeMap);
+        free(store->vcb->extents.nodes);
+        free(store->data);
+        free(store->fileEntry);
+        free(store->dirTable);
+        free(store->freeSlots);
+        free(store->fat);
+    }
+    free(store->vcb);
+    free(store);
+}
+
+// text output of the store, dropped when the store is quiet
+void store_log(Store *store, const char *format, ...)
+{
+    if (!store->output.verbose)
+    {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    vfprintf(store->output.text, format, args);
+    va_end(args);
+}
+
+void store_logEvent(Store *store, int allocationType, int action, int fileName, int status)
+{
+    Output *out = &store->output;
+    if (out->eventFile == NULL)
+    {
+        return;
+    }
+    if (store->locks != NULL)
+    {
+        pthread_mutex_lock(&store->locks->sharedLock);
+    }
+    if (out->events == NULL)
+    {
+        out->events = malloc(sizeof(StoreEvent) * EVENT_BATCH);
+    }
+    StoreEvent *e = out->events + out->eventCount++;
+    e->allocationType = allocationType;
+    e->action = action;
+    e->fileName = fileName;
+    e->status = status;
+    e->freeBlocks = store->vcb->freeBlockNum;
+    if (out->eventCount == EVENT_BATCH)
+    {
+        store_flushEvents(store);
+    }
+    if (store->locks != NULL)
+    {
+        pthread_mutex_unlock(&store->locks->sharedLock);
+    }
+}
+
+BlockCache *cache_create(int capacity, int policy, BlockNo numBlocks)
+{
+    BlockCache *cache = malloc(sizeof(BlockCache));
+    cache->policy = policy;
+    cache->capacity = capacity;
+    cache->used = 0;
+    cache->frameBlock = malloc(sizeof(BlockNo) * capacity);
+    cache->frameOf = malloc(sizeof(int) * numBlocks);
+    memset(cache->frameOf, 0xff, sizeof(int) * numBlocks);
+    cache->dirty = calloc(capacity, 1);
+    cache->referenced = calloc(capacity, 1);
+    cache->prev = malloc(sizeof(int) * capacity);
+    cache->next = malloc(sizeof(int) * capacity);
+    cache->head = -1;
+    cache->tail = -1;
+    cache->hand = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+    cache->writeBacks = 0;
+    return cache;
+}
+
+void cache_free(BlockCache *cache)
+{
+    if (cache == NULL)
+    {
+        return;
+    }
+    free(cache->frameBlock);
+    free(cache->frameOf);
+    free(cache->dirty);
+    free(cache->referenced);
+    free(cache->prev);
+    free(cache->next);
+    free(cache);
+}
+
+static void cache_unlink(BlockCache *cache, int frame)
+{
+    int p = cache->prev[frame];
+    int n = cache->next[frame];
+    if (p != -1)
+    {
+        cache->next[p] = n;
+    }
+    else
+    {
+        cache->head = n;
+    }
+    if (n != -1)
+    {
+        cache->prev[n] = p;
+    }
+    else
+    {
+        cache->tail = p;
+    }
+}
+
+static void cache_pushFront(BlockCache *cache, int frame)
+{
+    cache->prev[frame] = -1;
+    cache->next[frame] = cache->head;
+    if (cache->head != -1)
+    {
+        cache->prev[cache->head] = frame;
+    }
+    cache->head = frame;
+    if (cache->tail == -1)
+    {
+        cache->tail = frame;
+    }
+}
+
+// frame to reuse once the cache is full, its dirty block is written back
+static int cache_evict(BlockCache *cache, BlockNo *writeBack)
+{
+    int frame;
+    if (cache->policy == CACHE_CLOCK)
+    {
+        // second chance: skip and clear referenced frames
+        while (cache->referenced[cache->hand])
+        {
+            cache->referenced[cache->hand] = 0;
+            cache->hand = (cache->hand + 1) % cache->capacity;
+        }
+        frame = cache->hand;
+        cache->hand = (cache->hand + 1) % cache->capacity;
+    }
+    else
+    {
+        frame = cache->tail;
+        cache_unlink(cache, frame);
+    }
+    if (cache->dirty[frame])
+    {
+        cache->writeBacks++;
+        *writeBack = cache->frameBlock[frame];
+    }
+    cache->frameOf[cache->frameBlock[frame]] = -1;
+    return frame;
+}
+
+// one access to a block, write marks it dirty until it is written back
+// returns 1 when the block has to be read, writeBack is the evicted dirty block or -1
+int cache_access(BlockCache *cache, BlockNo block, int write, BlockNo *writeBack)
+{
+    int miss = 0;
+    *writeBack = -1;
+    int frame = cache->frameOf[block];
+    if (frame != -1)
+    {
+        cache->hits++;
+        if (cache->policy == CACHE_LRU && cache->head != frame)
+        {
+            cache_unlink(cache, frame);
+            cache_pushFront(cache, frame);
+        }
+    }
+    else
+    {
+        cache->misses++;
+        miss = 1;
+        frame = cache->used < cache->capacity ? cache->used++ : cache_evict(cache, writeBack);
+        cache->frameBlock[frame] = block;
+        cache->frameOf[block] = frame;
+        cache->dirty[frame] = 0;
+        if (cache->policy == CACHE_LRU)
+        {
+            cache_pushFront(cache, frame);
+        }
+    }
+    cache->referenced[frame] = 1;
+    cache->dirty[frame] |= write;
+    return miss;
+}
+
+DeviceModel *device_create(int type, int blockSize, BlockNo numBlocks)
+{
+    DeviceModel *device = calloc(1, sizeof(DeviceModel));
+    device->type = type;
+    device->numBlocks = numBlocks;
+    device->blocksPerPage = DEVICE_PAGE_BYTES / (sizeof(int) * blockSize);
+    if (device->blocksPerPage < 1)
+    {
+        device->blocksPerPage = 1;
+    }
+    double blockBytes = sizeof(int) * (double)blockSize;
+    if (type == DEVICE_HDD)
+    {
+        // 7200 rpm desktop disk streaming 150 MB/s
+        device->trackSeek = 500;
+        device->fullSeek = 9000;
+        device->halfRotation = 4167;
+        device->transfer = blockBytes / 150.0;
+    }
+    else if (type == DEVICE_SSD)
+    {
+        // SATA flash, 500 MB/s
+        device->readLatency = 80;
+        device->writeLatency = 250;
+        device->queueDepth = 32;
+        device->transfer = blockBytes / 500.0;
+    }
+    else
+    {
+        // NVMe flash, 3 GB/s
+        device->readLatency = 15;
+        device->writeLatency = 30;
+        device->queueDepth = 256;
+        device->transfer = blockBytes / 3000.0;
+    }
+    device->head = -2;
+    device->lastReadPage = -2;
+    device->lastWritePage = -2;
+    return device;
+}
+
+const char *device_name(int type)
+{
+    return type == DEVICE_HDD ? "HDD" : type == DEVICE_SSD ? "SSD" : "NVMe";
+}
+
+// adds the time one block transfer takes to the device clock
+void device_access(DeviceModel *device, BlockNo block, int write)
+{
+    // entry by entry accesses to the same block move it once
+    if (block == device->head)
+    {
+        return;
+    }
+    double cost = device->transfer;
+    if (device->type == DEVICE_HDD)
+    {
+        // the block right after the head streams, anything else waits for a seek and a rotation
+        if (block != device->head + 1)
+        {
+            BlockNo distance = block > device->head ? block - device->head : device->head - block;
+            cost += device->trackSeek + (device->fullSeek - device->trackSeek) * sqrt((double)distance / device->numBlocks) + device->halfRotation;
+            device->seeks++;
+        }
+    }
+    else
+    {
+        // a page already in the register is free, the next page was queued with the previous one
+        BlockNo page = block / device->blocksPerPage;
+        BlockNo *last = write ? &device->lastWritePage : &device->lastReadPage;
+        double latency = write ? device->writeLatency : device->readLatency;
+        if (page == *last + 1)
+        {
+            cost += latency / device->queueDepth;
+            device->pages++;
+        }
+        else if (page != *last)
+        {
+            cost += latency;
+            device->pages++;
+            device->seeks++;
+        }
+        *last = page;
+    }
+    device->head = block;
+    device->time += cost;
+}
+
+// one access through the cache when there is one, charged to the device when it has to go there
+static void store_access(Store *store, BlockNo index, int write)
+{
+    if (store->locks != NULL && (store->cache != NULL || store->device != NULL))
+    {
+        pthread_mutex_lock(&store->locks->sharedLock);
+    }
+    if (store->cache != NULL)
+    {
+        BlockNo writeBack;
+        int miss = cache_access(store->cache, index, write, &writeBack);
+        if (store->device != NULL && writeBack != -1)
+        {
+            device_access(store->device, writeBack, 1);
+        }
+        if (store->device != NULL && miss)
+        {
+            device_access(store->device, index, 0);
+        }
+    }
+    else if (store->device != NULL)
+    {
+        device_access(store->device, index, write);
+    }
+    if (store->locks != NULL && (store->cache != NULL || store->device != NULL))
+    {
+        pthread_mutex_unlock(&store->locks->sharedLock);
+    }
+}
+
+// writes every dirty block back, as a sync at the end of a run would
+void store_syncCache(Store *store)
+{
+    BlockCache *cache = store->cache;
+    for (int frame = 0; frame < cache->used; frame++)
+    {
+        if (cache->dirty[frame])
+        {
+            cache->writeBacks++;
+            cache->dirty[frame] = 0;
+            if (store->device != NULL)
+            {
+                device_access(store->device, cache->frameBlock[frame], 1);
+            }
+        }
+    }
+}
+
+// block holding block as the snapshot saw it, the probe starts at the slot the low bits of the block number pick
+static BlockNo snapshot_map(const Snapshot *snap, BlockNo block)
+{
+    for (BlockNo slot = block & snap->mapMask; snap->mapFrom[slot] != -1; slot = (slot + 1) & snap->mapMask)
+    {
+        if (snap->mapFrom[slot] == block)
+        {
+            return snap->mapTo[slot];
+        }
+    }
+    return block;
+}
+
+// view of a block without going through the cache, for printing
+static Block store_blockView(Store *store, BlockNo index)
+{
+    Block block;
+    BlockNo at = store->view != NULL ? snapshot_map(store->view, index) : index;
+    block.entries = store->data + (size_t)at * store->vcb->blockSize;
+    block.index = index;
+    return block;
+}
+
+Block store_getBlock(Store *store, BlockNo index)
+{
+    store_access(store, index, 0);
+    return store_blockView(store, index);
+}
+
+static void snapshot_preserve(Store *store, BlockNo index);
+
+// a block that is about to be changed, copied first when a snapshot still sees it
+Block store_getBlockForWrite(Store *store, BlockNo index)
+{
+    if (store->vcb->snapshots != NULL)
+    {
+        snapshot_preserve(store, index);
+    }
+    store_access(store, index, 1);
+    journal_note(store->vcb->journal, JOURNAL_BLOCK, index);
+    return store_blockView(store, index);
+}
+
+// a block that is about to be cleared and freed, a snapshot that still sees it keeps it as it is instead
+Block store_getBlockToFree(Store *store, BlockNo index)
+{
+    store_access(store, index, 1);
+    journal_note(store->vcb->journal, JOURNAL_BLOCK, index);
+    return store_blockView(store, index);
+}
+
+// count blocks read in one sweep, such as a scan of the whole volume
+void store_touchRange(Store *store, BlockNo start, BlockNo count)
+{
+    if (store->cache == NULL && store->device == NULL)
+    {
+        return;
+    }
+    for (BlockNo i = start; i < start + count && i < store->numBlocks; i++)
+    {
+        store_access(store, i, 0);
+    }
+}
+
+void block_clear(Block *block, int blockSize)
+{
+    for (int i = 0; i < blockSize; i++)
+    {
+        block->entries[i] = -1;
+    }
+}
+
+int vcb_isFree(VolumeControlBlock *vcb, BlockNo index)
+{
+    return (vcb->freeMap[index / FREEMAP_WORD_BITS] >> (index % FREEMAP_WORD_BITS)) & 1;
+}
+
+// return [start, start + count) to the extent tree, merging with the neighbours
+static void vcb_releaseExtent(VolumeControlBlock *vcb, BlockNo start, BlockNo count)
+{
+    ExtentTree *t = &vcb->extents;
+    int before = start > 0 ? extent_findContaining(t, start - 1) : -1;
+    int after = extent_findContaining(t, start + count);
+    if (before != -1)
+    {
+        count += start - t->nodes[before].start;
+        start = t->nodes[before].start;
+        extent_remove(t, before);
+    }
+    if (after != -1)
+    {
+        count += t->nodes[after].length;
+        extent_remove(t, after);
+    }
+    extent_insert(t, start, count);
+}
+
+// take [start, end) out of whatever free extents overlap it
+static void vcb_claimExtents(VolumeControlBlock *vcb, BlockNo start, BlockNo end)
+{
+    ExtentTree *t = &vcb->extents;
+    while (start < end)
+    {
+        int n = extent_findContaining(t, start);
+        if (n == -1)
+        {
+            n = extent_findFrom(t, start);
+            if (n == -1 || t->nodes[n].start >= end)
+            {
+                return;
+            }
+            start = t->nodes[n].start;
+        }
+        BlockNo from = t->nodes[n].start;
+        BlockNo to = from + t->nodes[n].length;
+        extent_remove(t, n);
+        if (from < start)
+        {
+            extent_insert(t, from, start - from);
+        }
+        if (end < to)
+        {
+            extent_insert(t, end, to - end);
+        }
+        start = to;
+    }
+}
+
+// adds block -> to to the map of a snapshot, doubling the map past half full
+static void snapshot_mapInsert(Snapshot *snap, BlockNo block, BlockNo to)
+{
+    if ((snap->mapCount + 1) * 2 > snap->mapMask + 1)
+    {
+        BlockNo size = snap->mapMask + 1;
+        BlockNo *from = snap->mapFrom;
+        BlockNo *old = snap->mapTo;
+        snap->mapMask = size * 2 - 1;
+        snap->mapFrom = malloc(sizeof(BlockNo) * size * 2);
+        snap->mapTo = malloc(sizeof(BlockNo) * size * 2);
+        memset(snap->mapFrom, 0xff, sizeof(BlockNo) * size * 2);
+        snap->mapCount = 0;
+        for (BlockNo i = 0; i < size; i++)
+        {
+            if (from[i] != -1)
+            {
+                snapshot_mapInsert(snap, from[i], old[i]);
+            }
+        }
+        free(from);
+        free(old);
+    }
+    BlockNo slot = block & snap->mapMask;
+    while (snap->mapFrom[slot] != -1)
+    {
+        slot = (slot + 1) & snap->mapMask;
+    }
+    snap->mapFrom[slot] = block;
+    snap->mapTo[slot] = to;
+    snap->mapCount++;
+}
+
+// whether some snapshot reads a used block of the live volume as the block is now
+static int snapshot_sees(const SnapshotSet *set, BlockNo block)
+{
+    return set->newest != NULL && set->refs[block] == 0 && set->blockGeneration[block] < set->newest->generation;
+}
+
+// points every snapshot that sees block at to instead, the live content of block dates from now on
+static void snapshot_hold(SnapshotSet *set, BlockNo block, BlockNo to)
+{
+    for (Snapshot *snap = set->newest; snap != NULL && snap->generation > set->blockGeneration[block]; snap = snap->older)
+    {
+        snapshot_mapInsert(snap, block, to);
+        set->refs[to]++;
+    }
+    set->blockGeneration[block] = set->generation;
+}
+
+// hands a block the live volume is freeing to the snapshots that still see it, returns 0 when it can be freed
+static int snapshot_keep(VolumeControlBlock *vcb, BlockNo block)
+{
+    SnapshotSet *set = vcb->snapshots;
+    if (set == NULL || !snapshot_sees(set, block))
+    {
+        return 0;
+    }
+    snapshot_hold(set, block, block);
+    set->kept++;
+    return 1;
+}
+
+// the block stays in use with its entries when a snapshot keeps it
+void vcb_freeBlock(VolumeControlBlock *vcb, Block *block)
+{
+    if (snapshot_keep(vcb, block->index))
+    {
+        return;
+    }
+    BlockNo word = block->index / FREEMAP_WORD_BITS;
+    block_clear(block, vcb->blockSize);
+    vcb->freeMap[word] |= 1ULL << (block->index % FREEMAP_WORD_BITS);
+    journal_note(vcb->journal, JOURNAL_BLOCK, block->index);
+    journal_note(vcb->journal, JOURNAL_FREE_MAP, word);
+    vcb->freeBlockNum += 1;
+    if (word < vcb->freeMapHint)
+    {
+        vcb->freeMapHint = word;
+    }
+    vcb_releaseExtent(vcb, block->index, 1);
+}
+
+void vcb_useBlock(VolumeControlBlock *vcb, BlockNo index)
+{
+    if (vcb->snapshots != NULL)
+    {
+        vcb->snapshots->blockGeneration[index] = vcb->snapshots->generation;
+    }
+    vcb->freeMap[index / FREEMAP_WORD_BITS] &= ~(1ULL << (index % FREEMAP_WORD_BITS));
+    journal_note(vcb->journal, JOURNAL_FREE_MAP, index / FREEMAP_WORD_BITS);
+    vcb->freeBlockNum -= 1;
+    vcb_claimExtents(vcb, index, index + 1);
+}
+
+// mask selecting bits [from, to) of a single bitmap word
+static uint64_t freeMap_mask(int from, int to)
+{
+    uint64_t high = to >= FREEMAP_WORD_BITS ? ~0ULL : (1ULL << to) - 1;
+    return high & ~((1ULL << from) - 1);
+}
+
+// mark count blocks starting at start as used, a word at a time
+void vcb_useRange(VolumeControlBlock *vcb, BlockNo start, BlockNo count)
+{
+    BlockNo end = start + count;
+    vcb_claimExtents(vcb, start, end);
+    for (BlockNo b = start; vcb->snapshots != NULL && b < end; b++)
+    {
+        vcb->snapshots->blockGeneration[b] = vcb->snapshots->generation;
+    }
+    while (start < end)
+    {
+        BlockNo word = start / FREEMAP_WORD_BITS;
+        int from = start % FREEMAP_WORD_BITS;
+        int to = from + (end - start) < FREEMAP_WORD_BITS ? from + (end - start) : FREEMAP_WORD_BITS;
+        uint64_t mask = freeMap_mask(from, to);
+        vcb->freeBlockNum -= __builtin_popcountll(vcb->freeMap[word] & mask);
+        vcb->freeMap[word] &= ~mask;
+        journal_note(vcb->journal, JOURNAL_FREE_MAP, word);
+        start += to - from;
+    }
+}
+
+// mark a run of used blocks free again
+static void vcb_freeRun(VolumeControlBlock *vcb, BlockNo start, BlockNo count)
+{
+    BlockNo end = start + count;
+    if (start / FREEMAP_WORD_BITS < vcb->freeMapHint)
+    {
+        vcb->freeMapHint = start / FREEMAP_WORD_BITS;
+    }
+    vcb_releaseExtent(vcb, start, count);
+    while (start < end)
+    {
+        BlockNo word = start / FREEMAP_WORD_BITS;
+        int from = start % FREEMAP_WORD_BITS;
+        int to = from + (end - start) < FREEMAP_WORD_BITS ? from + (end - start) : FREEMAP_WORD_BITS;
+        uint64_t mask = freeMap_mask(from, to);
+        vcb->freeBlockNum += __builtin_popcountll(~vcb->freeMap[word] & mask);
+        vcb->freeMap[word] |= mask;
+        journal_note(vcb->journal, JOURNAL_FREE_MAP, word);
+        start += to - from;
+    }
+}
+
+// mark a run of used blocks free again, the caller clears their entries but those of blocks a snapshot keeps
+// the runs between kept blocks are freed
+void vcb_freeRange(VolumeControlBlock *vcb, BlockNo start, BlockNo count)
+{
+    BlockNo run = start;
+    for (BlockNo b = start; vcb->snapshots != NULL && b < start + count; b++)
+    {
+        if (snapshot_keep(vcb, b))
+        {
+            if (b > run)
+            {
+                vcb_freeRun(vcb, run, b - run);
+            }
+            run = b + 1;
+        }
+    }
+    if (start + count > run)
+    {
+        vcb_freeRun(vcb, run, start + count - run);
+    }
+}
+
+// start of a free run of count blocks placed by the fit policy, or -1
+BlockNo vcb_findFreeRun(VolumeControlBlock *vcb, BlockNo count, BlockNo *traversals)
+{
+    int n = extent_findFit(&vcb->extents, count, vcb->fitPolicy, traversals);
+    return n == -1 ? -1 : vcb->extents.nodes[n].start;
+}
+
+// index of the first word at or after from with any free bit, or freeMapWords
+static BlockNo freeMap_findNonZeroWord(const VolumeControlBlock *vcb, BlockNo from)
+{
+    const uint64_t *map = vcb->freeMap;
+    BlockNo words = vcb->freeMapWords;
+    BlockNo i = from;
+    if (words >= FREEMAP_SIMD_MIN_WORDS)
+    {
+#if defined(__AVX2__)
+        for (; i + 4 <= words; i += 4)
+        {
+            __m256i v = _mm256_loadu_si256((const __m256i *)(map + i));
+            if (!_mm256_testz_si256(v, v))
+            {
+                break;
+            }
+        }
+#elif defined(__SSE2__)
+        const __m128i zero = _mm_setzero_si128();
+        for (; i + 2 <= words; i += 2)
+        {
+            __m128i v = _mm_loadu_si128((const __m128i *)(map + i));
+            if (_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) != 0xFFFF)
+            {
+                break;
+            }
+        }
+#endif
+    }
+    while (i < words && map[i] == 0)
+    {
+        i++;
+    }
+    return i;
+}
+
+// lowest free block, or -1 when the volume is full
+BlockNo vcb_lowestFree(VolumeControlBlock *vcb)
+{
+    BlockNo word = freeMap_findNonZeroWord(vcb, vcb->freeMapHint);
+    vcb->freeMapHint = word;
+    if (word == vcb->freeMapWords)
+    {
+        return -1;
+    }
+    return word * FREEMAP_WORD_BITS + __builtin_ctzll(vcb->freeMap[word]);
+}
+
+// lowest free block, or -1 when the volume is full, logged with the words it took to find
+BlockNo store_findFreeBlock(Store *store)
+{
+    BlockNo index = vcb_lowestFree(store->vcb);
+    if (index == -1)
+    {
+        return -1;
+    }
+    BlockNo word = index / FREEMAP_WORD_BITS;
+    store->traversals += word + 1;
+    store_log(store, "B%lld found in %lld traversals\n", index, word + 1);
+    return index;
+}
+
+// first free block at or after from, wrapping round to the lowest one, or -1 when the volume is full
+BlockNo vcb_nextFree(VolumeControlBlock *vcb, BlockNo from)
+{
+    if (from < 0 || from >= vcb->numBlocks)
+    {
+        return vcb_lowestFree(vcb);
+    }
+    BlockNo word = from / FREEMAP_WORD_BITS;
+    uint64_t bits = vcb->freeMap[word] & ~((1ULL << (from % FREEMAP_WORD_BITS)) - 1);
+    if (bits == 0)
+    {
+        word = freeMap_findNonZeroWord(vcb, word + 1);
+        if (word == vcb->freeMapWords)
+        {
+            return vcb_lowestFree(vcb);
+        }
+        bits = vcb->freeMap[word];
+    }
+    return word * FREEMAP_WORD_BITS + __builtin_ctzll(bits);
+}
+
+// free block closest after near, so a growing file stays next to its last block
+BlockNo store_findFreeBlockNear(Store *store, BlockNo near)
+{
+    BlockNo index = vcb_nextFree(store->vcb, near);
+    if (index == -1)
+    {
+        return -1;
+    }
+    BlockNo words = index >= near ? (index - near) / FREEMAP_WORD_BITS + 1 : 1;
+    store->traversals += words;
+    store_log(store, "B%lld found in %lld traversals\n", index, words);
+    return index;
+}
+
+// copies a used block that a snapshot still sees to a free one for the snapshots, before the live volume changes it
+static void snapshot_preserve(Store *store, BlockNo index)
+{
+    VolumeControlBlock *vcb = store->vcb;
+    SnapshotSet *set = vcb->snapshots;
+    if (vcb_isFree(vcb, index) || !snapshot_sees(set, index))
+    {
+        return;
+    }
+    BlockNo one = 1;
+    BlockNo visits = 0;
+    BlockNo copy = store->buddy != NULL ? buddy_allocate(store->buddy, &one, &visits) : vcb_lowestFree(vcb);
+    if (copy == -1)
+    {
+        set->lost++;
+        set->blockGeneration[index] = set->generation;
+        return;
+    }
+    vcb_useBlock(vcb, copy);
+    memcpy(store->data + (size_t)copy * vcb->blockSize, store->data + (size_t)index * vcb->blockSize, sizeof(int) * vcb->blockSize);
+    store_access(store, copy, 1);
+    journal_note(vcb->journal, JOURNAL_BLOCK, copy);
+    snapshot_hold(set, index, copy);
+    set->copies++;
+}
+
+// whether a snapshot still sees block, freeing it then leaves its entries as they are
+static int store_snapshotSees(Store *store, BlockNo block)
+{
+    return store->vcb->snapshots != NULL && snapshot_sees(store->vcb->snapshots, block);
+}
+
+// frees the run of a contiguous or buddy file, the blocks a snapshot keeps stay in use
+// a buddy run goes back whole when nothing was kept, otherwise block by block so its free parts still merge
+static void store_freeRun(Store *store, BlockNo start, BlockNo count)
+{
+    vcb_freeRange(store->vcb, start, count);
+    if (store->buddy == NULL)
+    {
+        return;
+    }
+    BlockNo freed = 0;
+    for (BlockNo b = start; b < start + count; b++)
+    {
+        freed += vcb_isFree(store->vcb, b);
+    }
+    for (BlockNo b = start; b < start + count && freed < count; b++)
+    {
+        if (vcb_isFree(store->vcb, b))
+        {
+            buddy_release(store->buddy, b, 1);
+        }
+    }
+    if (freed == count)
+    {
+        buddy_release(store->buddy, start, count);
+    }
+}
+
+static unsigned int dir_hash(int fileName)
+{
+    // fibonacci hashing spreads the clustered names (100, 200, ...) apart, the high half of the
+    // 64-bit product keeps every slot of the largest tables reachable
+    return (unsigned int)(((uint64_t)(unsigned int)fileName * 0x9E3779B97F4A7C15ull) >> 32);
+}
+
+// position of fileName in the directory index, or of the empty slot ending its probe
+static int dir_probe(Store *store, int fileName)
+{
+    int pos = dir_hash(fileName) & store->dirTableMask;
+    while (store->dirTable[pos] != -1 && store->fileEntry[store->dirTable[pos]].fileName != fileName)
+    {
+        pos = (pos + 1) & store->dirTableMask;
+    }
+    return pos;
+}
+
+FileEntry *store_lookupFile(Store *store, int fileName)
+{
+    if (fileName == 0)
+    {
+        return NULL;
+    }
+    if (store->locks != NULL)
+    {
+        pthread_rwlock_rdlock(&store->locks->dirLock);
+    }
+    int slot = store->dirTable[dir_probe(store, fileName)];
+    if (store->locks != NULL)
+    {
+        pthread_rwlock_unlock(&store->locks->dirLock);
+    }
+    return slot == -1 ? NULL : store->fileEntry + slot;
+}
+
+FileEntry *store_findFreeFileEntry(Store *store)
+{
+    if (store->freeSlotCount == 0)
+    {
+        return NULL;
+    }
+    return store->fileEntry + store->freeSlots[store->freeSlotCount - 1];
+}
+
+// claim the entry returned by store_findFreeFileEntry for fileName
+void store_bindFileEntry(Store *store, FileEntry *entry, int fileName)
+{
+    int slot = entry - store->fileEntry;
+    store->freeSlotCount--;
+    if (store->locks != NULL)
+    {
+        pthread_rwlock_wrlock(&store->locks->dirLock);
+    }
+    entry->fileName = fileName;
+    store->dirTable[dir_probe(store, fileName)] = slot;
+    journal_note(store->vcb->journal, JOURNAL_FILE_ENTRY, slot);
+    if (store->locks != NULL)
+    {
+        pthread_rwlock_unlock(&store->locks->dirLock);
+    }
+}
+
+// forget where the last read by offset of fileName stopped, its blocks are going away
+void store_dropCursor(Store *store, int fileName)
+{
+    ChainCursor *cursor = store->cursors + dir_hash(fileName) % CURSOR_SLOTS;
+    if (store->locks != NULL)
+    {
+        pthread_mutex_lock(&store->locks->sharedLock);
+    }
+    if (cursor->fileName == fileName)
+    {
+        cursor->fileName = 0;
+    }
+    if (store->locks != NULL)
+    {
+        pthread_mutex_unlock(&store->locks->sharedLock);
+    }
+}
+
+// clear the entry and return its slot to the free list
+void store_releaseFileEntry(Store *store, FileEntry *entry)
+{
+    int mask = store->dirTableMask;
+    if (store->locks != NULL)
+    {
+        pthread_rwlock_wrlock(&store->locks->dirLock);
+    }
+    int hole = dir_probe(store, entry->fileName);
+    store->dirTable[hole] = -1;
+    // shift later members of the probe run back so lookups never hit a gap
+    for (int pos = (hole + 1) & mask; store->dirTable[pos] != -1; pos = (pos + 1) & mask)
+    {
+        int home = dir_hash(store->fileEntry[store->dirTable[pos]].fileName) & mask;
+        if (((pos - home) & mask) >= ((pos - hole) & mask))
+        {
+            store->dirTable[hole] = store->dirTable[pos];
+            store->dirTable[pos] = -1;
+            hole = pos;
+        }
+    }
+    if (store->locks != NULL)
+    {
+        pthread_rwlock_unlock(&store->locks->dirLock);
+    }
+
+    store_dropCursor(store, entry->fileName);
+    entry->fileName = 0;
+    entry->params[0] = 0;
+    entry->params[1] = 0;
+    entry->fileSize = 0;
+    entry->packedBits = 0;
+    store->freeSlots[store->freeSlotCount++] = entry - store->fileEntry;
+    journal_note(store->vcb->journal, JOURNAL_FILE_ENTRY, entry - store->fileEntry);
+}
+
+// after a crash only the file entries and the free map are trusted, the free extents and the directory index are built again from them
+void store_rebuildIndexes(Store *store)
+{
+    VolumeControlBlock *vcb = store->vcb;
+    ExtentTree *t = &vcb->extents;
+    t->used = 0;
+    t->freeNode = -1;
+    t->byStart = -1;
+    t->bySize = -1;
+    t->count = 0;
+    t->seed = 2463534242u;
+    memset(t->lengthCounts, 0, sizeof(t->lengthCounts));
+    vcb->freeBlockNum = 0;
+    vcb->freeMapHint = 0;
+    BlockNo runStart = -1;
+    for (BlockNo b = 0; b <= vcb->numBlocks; b++)
+    {
+        if (b < vcb->numBlocks && vcb_isFree(vcb, b))
+        {
+            vcb->freeBlockNum++;
+            runStart = runStart == -1 ? b : runStart;
+        }
+        else if (runStart != -1)
+        {
+            extent_insert(t, runStart, b - runStart);
+            runStart = -1;
+        }
+    }
+
+    for (int i = 0; i <= store->dirTableMask; i++)
+    {
+        store->dirTable[i] = -1;
+    }
+    // lowest slot on top, as store_format leaves it
+    store->freeSlotCount = 0;
+    for (int i = store->fileEntrySize - 1; i >= 0; i--)
+    {
+        if (store->fileEntry[i].fileName == 0)
+        {
+            store->freeSlots[store->freeSlotCount++] = i;
+        }
+        else
+        {
+            store->dirTable[dir_probe(store, store->fileEntry[i].fileName)] = i;
+        }
+    }
+}
+
+// note a content value written by a file, when the content index is on
+static void store_indexEntry(Store *s, int value, BlockNo block, int fileName)
+{
+    if (s->contentIndex != NULL)
+    {
+        contentIndex_add(s->contentIndex, value, block, fileName);
+    }
+}
+
+// forget the contents of a block that fileName is about to free
+static void store_unindexBlock(Store *s, Block block, int fileName)
+{
+    if (s->contentIndex == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < s->vcb->blockSize; i++)
+    {
+        if (block.entries[i] != -1)
+        {
+            contentIndex_remove(s->contentIndex, block.entries[i], block.index, fileName);
+        }
+    }
+}
+
+// a block holding exactly entries, found by fingerprint and read back to rule out a collision, or -1
+static BlockNo store_dedupFind(Store *s, const int *entries, uint64_t fingerprint)
+{
+    DedupIndex *index = s->dedup;
+    int blockSize = s->vcb->blockSize;
+    for (size_t pos = fingerprint & index->mask; index->slots[pos].block != -1; pos = (pos + 1) & index->mask)
+    {
+        if (index->slots[pos].fingerprint == fingerprint &&
+            memcmp(store_getBlock(s, index->slots[pos].block).entries, entries, sizeof(int) * blockSize) == 0)
+        {
+            return index->slots[pos].block;
+        }
+    }
+    return -1;
+}
+
+// takes a block out of the dedup index before its entries change or it is freed
+static void store_dedupForget(Store *s, Block block, int packedBits)
+{
+    s->dedup->refs[block.index] = 0;
+    dedup_remove(s->dedup, dedup_fingerprint(block.entries, s->vcb->blockSize, packedBits), block.index);
+}
+
+// index block pointers kept past the direct ones: single, double and triple indirect
+static int indexed_indirectSlots(int blockSize)
+{
+    return blockSize - 1 < 3 ? blockSize - 1 : 3;
+}
+
+// content blocks one index block can reach, a file that fits in blockSize uses direct pointers only
+static BlockNo indexed_capacity(int blockSize)
+{
+    BlockNo capacity = blockSize - indexed_indirectSlots(blockSize);
+    BlockNo span = 1;
+    for (int level = 1; level <= indexed_indirectSlots(blockSize); level++)
+    {
+        span *= blockSize;
+        capacity += span;
+        if (capacity > MAX_BLOCKS)
+        {
+            return MAX_BLOCKS;
+        }
+    }
+    return capacity < blockSize ? blockSize : capacity;
+}
+
+// index block plus the indirect blocks a file of contentBlocks blocks needs
+static BlockNo indexed_metaBlocks(int blockSize, BlockNo contentBlocks)
+{
+    if (contentBlocks <= blockSize)
+    {
+        return 1;
+    }
+    BlockNo meta = 1;
+    BlockNo left = contentBlocks - (blockSize - indexed_indirectSlots(blockSize));
+    BlockNo span = blockSize;
+    for (int level = 1; level <= indexed_indirectSlots(blockSize) && left > 0; level++)
+    {
+        BlockNo take = left < span ? left : span;
+        // one block per level of the subtree, each covering a smaller span
+        for (BlockNo below = span; below > 1; below /= blockSize)
+        {
+            meta += (take + below - 1) / below;
+        }
+        left -= take;
+        span *= blockSize;
+    }
+    return meta;
+}
+
+// entries a packed content block holds: a base value, then bits wide offsets from it in the other words
+static int packed_capacity(int blockSize, int bits)
+{
+    return (blockSize - 1) * 32 / bits;
+}
+
+// entries per content block of an indexed file
+static int indexed_perBlock(int blockSize, const FileEntry *fe)
+{
+    return fe->packedBits == 0 ? blockSize : packed_capacity(blockSize, fe->packedBits);
+}
+
+// narrowest width that every run of values packed into one block fits in above its smallest value,
+// 0 when packing would not save a block
+static int packed_chooseBits(const int *values, int count, int blockSize)
+{
+    for (int bits = 1; bits < 32; bits++)
+    {
+        int capacity = packed_capacity(blockSize, bits);
+        if (capacity <= blockSize)
+        {
+            return 0;
+        }
+        int fits = 1;
+        for (int start = 0; fits && start < count; start += capacity)
+        {
+            int low = values[start];
+            int high = values[start];
+            for (int i = start + 1; i < count && i < start + capacity; i++)
+            {
+                low = values[i] < low ? values[i] : low;
+                high = values[i] > high ? values[i] : high;
+            }
+            fits = (long long)high - low < (1LL << bits);
+        }
+        if (fits)
+        {
+            return (count + capacity - 1) / capacity < (count + blockSize - 1) / blockSize ? bits : 0;
+        }
+    }
+    return 0;
+}
+
+// packs count values into a block, the first word holds their smallest value
+static void packed_encode(int *block, int blockSize, int bits, const int *values, int count)
+{
+    int base = values[0];
+    for (int i = 1; i < count; i++)
+    {
+        base = values[i] < base ? values[i] : base;
+    }
+    block[0] = base;
+    memset(block + 1, 0, sizeof(int) * (blockSize - 1));
+    uint32_t *words = (uint32_t *)(block + 1);
+    for (int i = 0; i < count; i++)
+    {
+        uint32_t delta = (uint32_t)values[i] - (uint32_t)base;
+        long long bit = (long long)i * bits;
+        int shift = bit & 31;
+        words[bit >> 5] |= delta << shift;
+        if (shift + bits > 32)
+        {
+            words[(bit >> 5) + 1] |= delta >> (32 - shift);
+        }
+    }
+}
+
+// unpacks entries from to from + count - 1 of a packed block
+static void packed_decode(const int *block, int blockSize, int bits, int from, int count, int *out)
+{
+    const uint32_t *words = (const uint32_t *)(block + 1);
+    uint32_t base = (uint32_t)block[0];
+    uint32_t mask = (1u << bits) - 1;
+    int i = from;
+    int end = from + count;
+#if defined(__AVX2__)
+    // eight entries at a time, each lane gathers the word its entry starts in and the one after
+    const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+    const __m256i width = _mm256_set1_epi32(bits);
+    const __m256i low5 = _mm256_set1_epi32(31);
+    const __m256i thirtyTwo = _mm256_set1_epi32(32);
+    const __m256i maskV = _mm256_set1_epi32((int)mask);
+    const __m256i baseV = _mm256_set1_epi32((int)base);
+    for (; i + 8 <= end && (((long long)(i + 7) * bits) >> 5) + 1 < blockSize - 1; i += 8)
+    {
+        __m256i bit = _mm256_mullo_epi32(_mm256_add_epi32(_mm256_set1_epi32(i), lane), width);
+        __m256i word = _mm256_srli_epi32(bit, 5);
+        __m256i shift = _mm256_and_si256(bit, low5);
+        __m256i lo = _mm256_i32gather_epi32((const int *)words, word, 4);
+        __m256i hi = _mm256_i32gather_epi32((const int *)words + 1, word, 4);
+        // a shift by 32 gives 0, so entries inside one word take nothing from the next
+        __m256i v = _mm256_or_si256(_mm256_srlv_epi32(lo, shift), _mm256_sllv_epi32(hi, _mm256_sub_epi32(thirtyTwo, shift)));
+        v = _mm256_add_epi32(_mm256_and_si256(v, maskV), baseV);
+        _mm256_storeu_si256((__m256i *)(out + i - from), v);
+    }
+#else
+    // only the gathers need the block size, to stay inside the block
+    (void)blockSize;
+#endif
+    for (; i < end; i++)
+    {
+        long long bit = (long long)i * bits;
+        int shift = bit & 31;
+        uint32_t v = words[bit >> 5] >> shift;
+        if (shift + bits > 32)
+        {
+            v |= words[(bit >> 5) + 1] << (32 - shift);
+        }
+        out[i - from] = (int)(base + (v & mask));
+    }
+}
+
+// slot holding the k-th content block pointer of an indexed file, at most three indirect blocks away
+// missing indirect blocks are allocated when create is set, otherwise NULL is returned
+static int *indexed_slot(Store *s, Block indexBlock, BlockNo contentBlocks, BlockNo k, int create, int *reads)
+{
+    int blockSize = s->vcb->blockSize;
+    int direct = blockSize - indexed_indirectSlots(blockSize);
+    if (contentBlocks <= blockSize || k < direct)
+    {
+        return indexBlock.entries + k;
+    }
+    k -= direct;
+    BlockNo span = blockSize;
+    int level = 1;
+    while (k >= span)
+    {
+        k -= span;
+        span *= blockSize;
+        level++;
+    }
+    int *slot = indexBlock.entries + direct + level - 1;
+    for (; level > 0; level--)
+    {
+        if (*slot == -1)
+        {
+            if (!create)
+            {
+                return NULL;
+            }
+            BlockNo indirect = store_findFreeBlock(s);
+            vcb_useBlock(s->vcb, indirect);
+            *slot = indirect;
+        }
+        (*reads)++;
+        span /= blockSize;
+        slot = (create ? store_getBlockForWrite(s, *slot) : store_getBlock(s, *slot)).entries + k / span;
+        k %= span;
+    }
+    return slot;
+}
+
+// entries content block k of a file being added will hold, empty past the end of the file, or packed bits wide
+static void indexed_fillBlock(int *entries, const int *fileContents, int fileSize, BlockNo k, int blockSize, int packedBits)
+{
+    if (packedBits != 0)
+    {
+        int perBlock = packed_capacity(blockSize, packedBits);
+        BlockNo from = k * perBlock;
+        packed_encode(entries, blockSize, packedBits, fileContents + from, fileSize - from < perBlock ? fileSize - from : perBlock);
+        return;
+    }
+    for (int y = 0; y < blockSize; y++)
+    {
+        entries[y] = k * blockSize + y < fileSize ? fileContents[k * blockSize + y] : -1;
+    }
+}
+
+// turns on sharing of identical content blocks between indexed files, counting the references of the files already there
+// returns the number of blocks already shared
+BlockNo store_enableDedup(Store *s)
+{
+    DedupIndex *index = dedup_create(s->numBlocks);
+    int blockSize = s->vcb->blockSize;
+    BlockNo sharedBlocks = 0;
+    for (int i = 0; i < s->fileEntrySize; i++)
+    {
+        FileEntry *fe = s->fileEntry + i;
+        if (fe->fileName == 0 || fe->allocationType != ALLOC_INDEXED || fe->params[0] == -1)
+        {
+            continue;
+        }
+        Block indexBlock = store_blockView(s, fe->params[0]);
+        int reads = 0;
+        for (BlockNo k = 0; k < fe->params[1]; k++)
+        {
+            BlockNo block = *indexed_slot(s, indexBlock, fe->params[1], k, 0, &reads);
+            // blocks reserved past the end of the file hold nothing worth sharing yet
+            if (++index->refs[block] == 1 && k * indexed_perBlock(blockSize, fe) < fe->fileSize)
+            {
+                dedup_add(index, dedup_fingerprint(store_blockView(s, block).entries, blockSize, fe->packedBits), block);
+            }
+            sharedBlocks += index->refs[block] == 2;
+        }
+    }
+    s->dedup = index;
+    return sharedBlocks;
+}
+
+// switches an empty in-memory volume to keeping linked chains in a FAT
+void store_enableFat(Store *s)
+{
+    s->fat = malloc(sizeof(int) * s->numBlocks);
+    memset(s->fat, 0xff, sizeof(int) * s->numBlocks);
+}
+
+// ALLOC_LINKED through the FAT, every entry of a block holds content
+static int fat_add(Store *s, FileEntry *fe, int fileName, int fileSize, int *fileContents)
+{
+    int blockSize = s->vcb->blockSize;
+    BlockNo blocksNeeded = fileSize > 0 ? (fileSize + blockSize - 1) / blockSize : 1;
+    if (blocksNeeded > s->vcb->freeBlockNum)
+    {
+        store_log(s, "Not enough space for file\n");
+        return STATUS_NO_SPACE;
+    }
+
+    //find free block(s) and chain them in the table
+    BlockNo first = -1;
+    BlockNo last = -1;
+    for (BlockNo i = 0; i < blocksNeeded; i++)
+    {
+        BlockNo b = store_findFreeBlock(s);
+        vcb_useBlock(s->vcb, b);
+        if (last == -1)
+        {
+            first = b;
+        }
+        else
+        {
+            s->fat[last] = b;
+            journal_note(s->vcb->journal, JOURNAL_FAT, last);
+        }
+        last = b;
+    }
+    store_bindFileEntry(s, fe, fileName);
+    fe->params[0] = first;
+    fe->params[1] = last;
+    fe->fileSize = fileSize;
+
+    if (s->output.verbose)
+    {
+        store_log(s, "Adding File%d, found blocks: ", fileName);
+        for (BlockNo b = first; b != -1; b = s->fat[b])
+        {
+            store_log(s, "B%lld ", b);
+        }
+        store_log(s, "\n");
+    }
+    //allocate the file content to the blocks
+    store_log(s, "Added File%d at: ", fileName);
+    int filePos = 0;
+    for (BlockNo b = first; b != -1; b = s->fat[b])
+    {
+        Block block = store_getBlockForWrite(s, b);
+        store_log(s, "B%lld(", b);
+        for (int i = 0; i < blockSize && filePos < fileSize; i++, filePos++)
+        {
+            block.entries[i] = fileContents[filePos];
+            store_indexEntry(s, fileContents[filePos], b, fileName);
+            store_log(s, i == 0 ? "%d" : " %d", fileContents[filePos]);
+        }
+        store_log(s, s->fat[b] == -1 ? ")\n" : "), ");
+    }
+    return STATUS_OK;
+}
+
+static int fat_read(Store *s, int fileName)
+{
+    int fileActual = (fileName / 100) * 100;
+    FileEntry *fe = store_lookupFile(s, fileActual);
+    if (fe == NULL)
+    {
+        store_log(s, "File%d not found\n", fileName);
+        return STATUS_NOT_FOUND;
+    }
+    if (fileName == fileActual)
+    {
+        store_log(s, "File %d found\n", fileName);
+        return STATUS_OK;
+    }
+
+    //the table gives the next block without reading the current one to its end
+    int reads = 1;
+    int blockSize = s->vcb->blockSize;
+    for (BlockNo b = fe->params[0]; b != -1; b = s->fat[b])
+    {
+        Block block = store_getBlock(s, b);
+        store_log(s, "Reading B%lld(", b);
+        for (int i = 0; i < blockSize && block.entries[i] != -1; i++)
+        {
+            reads++;
+            store_log(s, "%d ", block.entries[i]);
+            if (block.entries[i] == fileName)
+            {
+                store_log(s, ")\nFile%d(%d) found in B%lld\n", fileActual, fileName, b);
+                s->reads += reads;
+                store_log(s, "Time = %d reads\n", reads);
+                return STATUS_OK;
+            }
+        }
+        store_log(s, s->fat[b] == -1 ? ")\n" : "), ");
+    }
+    store_log(s, "File%d not found\n", fileName);
+    s->reads += reads;
+    store_log(s, "Time = %d reads\n", reads);
+    return STATUS_NOT_FOUND;
+}
+
+static int fat_delete(Store *s, int fileName)
+{
+    FileEntry *fe = store_lookupFile(s, fileName);
+    if (fe == NULL)
+    {
+        store_log(s, "File%d not found\n", fileName);
+        return STATUS_NOT_FOUND;
+    }
+    BlockNo b = fe->params[0];
+    store_releaseFileEntry(s, fe);
+    store_log(s, "Deleted file %d and freed ", fileName);
+    while (b != -1)
+    {
+        BlockNo next = s->fat[b];
+        s->fat[b] = -1;
+        journal_note(s->vcb->journal, JOURNAL_FAT, b);
+        Block block = store_getBlockToFree(s, b);
+        store_unindexBlock(s, block, fileName);
+        vcb_freeBlock(s->vcb, &block);
+        store_log(s, "B%lld ", b);
+        b = next;
+    }
+    store_log(s, "\n");
+    return STATUS_OK;
+}
+
+// forgets the content of a packed indexed file, the entries of its blocks only mean something unpacked
+static void indexed_unindexPacked(Store *s, const FileEntry *fe)
+{
+    if (s->contentIndex == NULL || fe->packedBits == 0)
+    {
+        return;
+    }
+    int blockSize = s->vcb->blockSize;
+    int perBlock = packed_capacity(blockSize, fe->packedBits);
+    int *entries = malloc(sizeof(int) * perBlock);
+    Block indexBlock = store_blockView(s, fe->params[0]);
+    int reads = 0;
+    for (BlockNo k = 0; k * perBlock < fe->fileSize; k++)
+    {
+        BlockNo block = *indexed_slot(s, indexBlock, fe->params[1], k, 0, &reads);
+        int count = fe->fileSize - k * perBlock < perBlock ? fe->fileSize - k * perBlock : perBlock;
+        packed_decode(store_blockView(s, block).entries, blockSize, fe->packedBits, 0, count, entries);
+        for (int y = 0; y < count; y++)
+        {
+            contentIndex_remove(s->contentIndex, entries[y], block, fe->fileName);
+        }
+    }
+    free(entries);
+}
+
+// frees an indirect block and everything below it, depth 0 is a content block
+// the content of a packed file is unindexed beforehand, by indexed_unindexPacked
+static void indexed_freeTree(Store *s, BlockNo block, int depth, const FileEntry *fe)
+{
+    if (depth == 0 && s->dedup != NULL && s->dedup->refs[block] > 1)
+    {
+        // another file still points at the content block
+        if (fe->packedBits == 0)
+        {
+            store_unindexBlock(s, store_getBlock(s, block), fe->fileName);
+        }
+        s->dedup->refs[block]--;
+        return;
+    }
+    Block b = store_getBlockToFree(s, block);
+    if (depth == 0)
+    {
+        if (fe->packedBits == 0)
+        {
+            store_unindexBlock(s, b, fe->fileName);
+        }
+        if (s->dedup != NULL)
+        {
+            store_dedupForget(s, b, fe->packedBits);
+        }
+    }
+    else
+    {
+        for (int i = 0; i < s->vcb->blockSize && b.entries[i] != -1; i++)
+        {
+            indexed_freeTree(s, b.entries[i], depth - 1, fe);
+        }
+    }
+    vcb_freeBlock(s->vcb, &b);
+}
+
+// the last entry of a linked contiguous block is content, or empty, when the next block of the chain follows it,
+// and a pointer to the next block otherwise, kept as -(block + 2) so no content or empty entry reads as one
+static int linkedcontig_pointer(BlockNo block)
+{
+    return (int)(-block - 2);
+}
+
+static int linkedcontig_isPointer(int last)
+{
+    return last < -1;
+}
+
+static BlockNo linkedcontig_target(int last)
+{
+    return -(BlockNo)last - 2;
+}
+
+// whether count values can be linked contiguous content, the ones below -1 would read as pointers
+static int linkedcontig_canHold(const int *contents, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        if (contents[i] < -1)
+        {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+// returns one of the STATUS_ codes
+int store_add(Store *s, int allocationType, int fileName, int fileSize, int *fileContents)
+{
+    //if file exists then then don't add
+    if (store_lookupFile(s, fileName) != NULL)
+    {
+        store_log(s, "File %d already exists\n", fileName);
+        return STATUS_EXISTS;
+    }
+    else
+    {
+        if (allocationType == ALLOC_CONTIGUOUS || allocationType == ALLOC_BUDDY)
+        {
+            FileEntry *fe = store_findFreeFileEntry(s);
+            if (fe == NULL)
+            {
+                store_log(s, "No File Entry available\n");
+                return STATUS_NO_ENTRY;
+            }
+
+            // find the blocks required
+            BlockNo blocksRequired = fileSize / s->vcb->blockSize;
+
+            // round up the blocks required, an empty file still takes a block
+            if (fileSize % s->vcb->blockSize > 0 || blocksRequired == 0)
+            {
+                blocksRequired++;
+            }
+
+            //if file size is too big, return
+            if (s->vcb->freeBlockNum < blocksRequired)
+            {
+                store_log(s, "\nFile size too big");
+                return STATUS_NO_SPACE;
+            }
+
+            //find a free run that fits using the volume's fit policy, or a buddy run of the next power of two
+            //files of a delayed batch take the next blocks of the run reserved for it
+            BlockNo traversals = 0;
+            BlockNo i;
+            if (s->buddy == NULL && s->batchLeft >= blocksRequired)
+            {
+                i = s->batchStart;
+                s->batchStart += blocksRequired;
+                s->batchLeft -= blocksRequired;
+            }
+            else
+            {
+                i = s->buddy != NULL ? buddy_allocate(s->buddy, &blocksRequired, &traversals) : vcb_findFreeRun(s->vcb, blocksRequired, &traversals);
+            }
+            s->traversals += traversals;
+            store_log(s, "%lld Traversals to find blocks\n", traversals);
+            if (i == -1)
+            {
+                store_log(s, "No contiguous space found");
+                return STATUS_NO_SPACE;
+            }
+
+            store_log(s, "Adding file %d and found free ", fileName);
+            //allocate the blocks
+            vcb_useRange(s->vcb, i, blocksRequired);
+            for (BlockNo j = 0; j < blocksRequired; ++j)
+            {
+                store_log(s, "B%lld ", i + j);
+            }
+            store_log(s, "\n");
+
+            int prevBlock = -1;
+            store_log(s, "Adding file%d at", fileName);
+            for (int j = 0; j < fileSize; ++j)
+            {
+                int blockOffset = j / s->vcb->blockSize;
+
+                if (prevBlock != blockOffset)
+                {
+                    if (prevBlock != -1)
+                    {
+                        store_log(s, ")");
+                    }
+                    store_log(s, " B%lld(", i + blockOffset);
+                    prevBlock = blockOffset;
+                }
+                store_getBlockForWrite(s, i + blockOffset).entries[j % s->vcb->blockSize] = fileContents[j];
+                store_indexEntry(s, fileContents[j], i + blockOffset, fileName);
+                store_log(s, "%d ", fileContents[j]);
+            }
+            if (fileSize == 0)
+            {
+                store_log(s, " B%lld(", i);
+            }
+            store_log(s, ")\n");
+
+            //allocate the file entry appropriately
+            fe->allocationType = allocationType;
+            store_bindFileEntry(s, fe, fileName);
+            fe->params[0] = i;
+            fe->params[1] = blocksRequired;
+            fe->fileSize = fileSize;
+        }
+        else if (allocationType == ALLOC_LINKED)
+        {
+            // Get File Entry if none available, End
+            FileEntry *fe = store_findFreeFileEntry(s);
+            if (fe == NULL)
+            {
+                store_log(s, "No File Entry available\n");
+                return STATUS_NO_ENTRY;
+            }
+            else if (s->fat != NULL)
+            {
+                return fat_add(s, fe, fileName, fileSize, fileContents);
+            }
+            else
+            {
+                // Get Number of blocks needed
+                int blockSize = s->vcb->blockSize;
+                int blocksNeeded = 0;
+                int entriesLeft = fileSize;
+                while (entriesLeft > blockSize)
+                {
+                    entriesLeft -= (blockSize - 1);
+                    blocksNeeded++;
+                }
+                blocksNeeded++;
+
+                // If there is not enoguh space, End. Else start file allocation
+                if (blocksNeeded > s->vcb->freeBlockNum)
+                {
+                    store_log(s, "Not enough space for file\n");
+                    return STATUS_NO_SPACE;
+                }
+                else
+                {
+                    Block *blocks = malloc(sizeof(Block) * blocksNeeded);
+                    //find free block(s)
+                    for (int i = 0; i < blocksNeeded; i++)
+                    {
+                        blocks[i] = store_getBlockForWrite(s, store_findFreeBlock(s));
+                        vcb_useBlock(s->vcb, blocks[i].index);
+                    }
+                    store_log(s, "Adding File%d, found blocks: ", fileName);
+                    for (int i = 0; i < blocksNeeded; i++)
+                    {
+                        store_log(s, "B%lld ", blocks[i].index);
+                    }
+                    store_log(s, "\n");
+                    //set file entry to values
+                    store_bindFileEntry(s, fe, fileName);
+                    fe->params[0] = blocks[0].index;
+                    fe->params[1] = blocks[blocksNeeded - 1].index;
+                    fe->fileSize = fileSize;
+
+                    //allocate the file content to the blocks
+                    store_log(s, "Added File%d at: ", fileName);
+                    int filePos = 0;
+                    for (int i = 0; i < blocksNeeded; i++)
+                    {
+                        store_log(s, "B%lld(", blocks[i].index);
+                        int count = 0;
+                        //Fill upto blocksize - 1 or if fileSize - 1
+                        while (count < blockSize - 1 && filePos < fileSize - 1)
+                        {
+                            blocks[i].entries[count] = fileContents[filePos];
+                            store_indexEntry(s, fileContents[filePos], blocks[i].index, fileName);
+                            store_log(s, "%d ", fileContents[filePos]);
+                            count++;
+                            filePos++;
+                        }
+                        //if there is leftover point to the next block. else fill the slot with file entry
+                        if (i < blocksNeeded - 1)
+                        {
+                            blocks[i].entries[count] = blocks[i + 1].index;
+                            store_log(s, "), ");
+                        }
+                        else if (filePos < fileSize)
+                        {
+                            blocks[i].entries[count] = fileContents[filePos];
+                            store_indexEntry(s, fileContents[filePos], blocks[i].index, fileName);
+                            store_log(s, "%d)\n", fileContents[filePos]);
+                        }
+                        else if (fileSize == 0)
+                        {
+                            store_log(s, ")\n");
+                        }
+                    }
+                    free(blocks);
+                }
+            }
+        }
+        else if (allocationType == ALLOC_INDEXED)
+        {
+            int blockSize = s->vcb->blockSize;
+            // round up the filesize / blocksize
+            // because any remainder means extra block is needed
+            BlockNo contentBlocks = (fileSize + blockSize - 1) / blockSize;
+            // with compression, content blocks are packed when that takes fewer of them
+            int packedBits = s->compress ? packed_chooseBits(fileContents, fileSize, blockSize) : 0;
+            int perBlock = packedBits != 0 ? packed_capacity(blockSize, packedBits) : blockSize;
+            BlockNo plainBlocks = contentBlocks;
+            contentBlocks = (fileSize + perBlock - 1) / perBlock;
+            // the index block, and the indirect blocks once the file outgrows it
+            BlockNo blocksRequired = contentBlocks + indexed_metaBlocks(blockSize, contentBlocks);
+
+            // with dedup, content blocks identical to one already on the volume share it and need no block of their own
+            BlockNo *shared = NULL;
+            int *content = NULL;
+            if (s->dedup != NULL && contentBlocks <= indexed_capacity(blockSize))
+            {
+                shared = malloc(sizeof(BlockNo) * (contentBlocks + 1));
+                content = malloc(sizeof(int) * blockSize);
+                for (BlockNo i = 0; i < contentBlocks; i++)
+                {
+                    indexed_fillBlock(content, fileContents, fileSize, i, blockSize, packedBits);
+                    shared[i] = store_dedupFind(s, content, dedup_fingerprint(content, blockSize, packedBits));
+                    blocksRequired -= shared[i] != -1;
+                }
+            }
+
+            // when the file is more than the index block can reach
+            // or when blocksRequired is more than numbers of free block
+            if (contentBlocks > indexed_capacity(blockSize) || blocksRequired > s->vcb->freeBlockNum)
+            {
+                store_log(s, "Not enough space\n");
+                free(shared);
+                free(content);
+                return STATUS_NO_SPACE;
+            }
+            FileEntry *entry = store_findFreeFileEntry(s);
+            if (entry == NULL)
+            {
+                store_log(s, "No File Entry available\n");
+                free(shared);
+                free(content);
+                return STATUS_NO_ENTRY;
+            }
+
+            Block indexBlock = store_getBlockForWrite(s, store_findFreeBlock(s));
+            vcb_useBlock(s->vcb, indexBlock.index);
+            store_bindFileEntry(s, entry, fileName);
+            entry->params[0] = indexBlock.index;
+            entry->params[1] = contentBlocks;
+            entry->fileSize = fileSize;
+            entry->packedBits = packedBits;
+            if (packedBits != 0)
+            {
+                s->packedFiles++;
+                s->packedSaved += plainBlocks - contentBlocks;
+            }
+
+            int reads = 0;
+            // content blocks in file order, kept for printing
+            BlockNo *placed = s->output.verbose ? malloc(sizeof(BlockNo) * (contentBlocks + 1)) : NULL;
+            for (BlockNo i = 0; i < contentBlocks; i++)
+            {
+                BlockNo offset = (BlockNo)perBlock * i;
+                uint64_t fingerprint = 0;
+                if (shared != NULL && shared[i] == -1)
+                {
+                    // an earlier block of this same file may match
+                    indexed_fillBlock(content, fileContents, fileSize, i, blockSize, packedBits);
+                    fingerprint = dedup_fingerprint(content, blockSize, packedBits);
+                    shared[i] = store_dedupFind(s, content, fingerprint);
+                }
+                if (shared != NULL && shared[i] != -1)
+                {
+                    s->dedup->refs[shared[i]] += 1;
+                    s->dedup->shared++;
+                    for (int y = 0; y < perBlock && y + offset < fileSize; y++)
+                    {
+                        store_indexEntry(s, fileContents[y + offset], shared[i], fileName);
+                    }
+                    *indexed_slot(s, indexBlock, contentBlocks, i, 1, &reads) = shared[i];
+                    if (placed != NULL)
+                    {
+                        placed[i] = shared[i];
+                    }
+                    continue;
+                }
+                // find the next free block
+                Block contentBlock = store_getBlockForWrite(s, store_findFreeBlock(s));
+                vcb_useBlock(s->vcb, contentBlock.index);
+                // update the content block
+                if (packedBits != 0)
+                {
+                    indexed_fillBlock(contentBlock.entries, fileContents, fileSize, i, blockSize, packedBits);
+                }
+                for (int y = 0; y < perBlock && y + offset < fileSize; y++)
+                {
+                    if (packedBits == 0)
+                    {
+                        contentBlock.entries[y] = fileContents[y + offset];
+                    }
+                    store_indexEntry(s, fileContents[y + offset], contentBlock.index, fileName);
+                }
+                if (shared != NULL)
+                {
+                    s->dedup->refs[contentBlock.index] = 1;
+                    s->dedup->written++;
+                    dedup_add(s->dedup, fingerprint, contentBlock.index);
+                }
+                // update the index block, or the indirect block below it
+                *indexed_slot(s, indexBlock, contentBlocks, i, 1, &reads) = contentBlock.index;
+                if (placed != NULL)
+                {
+                    placed[i] = contentBlock.index;
+                }
+            }
+
+            //Printing
+            if (placed != NULL)
+            {
+                store_log(s, "Adding file%d and found free B%lld", fileName, indexBlock.index);
+                for (BlockNo i = 0; i < contentBlocks; i++)
+                {
+                    store_log(s, shared != NULL && s->dedup->refs[placed[i]] > 1 ? ", B%lld (shared)" : ", B%lld", placed[i]);
+                }
+                store_log(s, "\nAdded file%d at ", fileName);
+                for (BlockNo i = 0; i < contentBlocks; i++)
+                {
+                    BlockNo offset = (BlockNo)perBlock * i;
+                    store_log(s, "B%lld(", placed[i]);
+                    for (int y = 0; y < perBlock && y + offset < fileSize; y++)
+                    {
+                        store_log(s, y == 0 ? "%d" : ", %d", fileContents[y + offset]);
+                    }
+                    store_log(s, ") ");
+                }
+                store_log(s, "\n");
+                free(placed);
+            }
+            free(shared);
+            free(content);
+        }
+        else if (allocationType == ALLOC_LINKEDCONTIG)
+        {
+            //get the amount of entries required
+            int blockSize = s->vcb->blockSize;
+            int entriesRequired = fileSize;
+            if (fileSize == 0)
+            {
+                entriesRequired = 1;
+            }
+            BlockNo availableBlocks = 0;
+            int prevBlock = 1;
+            if (!linkedcontig_canHold(fileContents, fileSize))
+            {
+                store_log(s, "File%d holds values below -1, which a linked contiguous block cannot tell from a pointer\n", fileName);
+                return STATUS_NO_SPACE;
+            }
+            //get available file entry
+            FileEntry *fe = store_findFreeFileEntry(s);
+            if (fe == NULL)
+            {
+                store_log(s, "No File Entry available\n");
+                return STATUS_NO_ENTRY;
+            }
+            //get the number of blocks needed
+            while (blockSize * availableBlocks < entriesRequired)
+            {
+                BlockNo i;
+                for (i = 0; i < s->numBlocks; i++)
+                {
+                    if (vcb_isFree(s->vcb, i))
+                    {
+                        prevBlock = 0;
+                        availableBlocks++;
+                    }
+                    else
+                    {
+                        if (prevBlock == 0)
+                        {
+                            entriesRequired++;
+                        }
+                        prevBlock = 1;
+                    }
+                    if (blockSize * availableBlocks >= entriesRequired)
+                    {
+                        break;
+                    }
+                }
+                // counted once per scan, the counter is shared with other threads
+                s->traversals += i < s->numBlocks ? i + 1 : i;
+                //if not enough break
+                if (blockSize * availableBlocks < entriesRequired)
+                {
+                    store_log(s, "Not enough space found\n");
+                    return STATUS_NO_SPACE;
+                }
+            }
+
+            //allocate pointers to store the block
+            Block *blocks = malloc(sizeof(Block) * availableBlocks);
+            for (BlockNo i = 0; i < availableBlocks; i++)
+            {
+                blocks[i] = store_getBlockForWrite(s, store_findFreeBlock(s));
+                vcb_useBlock(s->vcb, blocks[i].index);
+            }
+            store_log(s, "Adding File%d, found blocks: ", fileName);
+            for (BlockNo i = 0; i < availableBlocks; i++)
+            {
+                store_log(s, "B%lld ", blocks[i].index);
+            }
+            store_log(s, "\n");
+            //set the file pointer to the blocks needed
+            store_bindFileEntry(s, fe, fileName);
+            fe->params[0] = blocks[0].index;
+            fe->params[1] = blocks[availableBlocks - 1].index;
+            fe->fileSize = fileSize;
+            BlockNo currBlock = 0;
+            int filePos = 0;
+            store_log(s, "Adding to ");
+            //while not the end of file
+            while (filePos < fileSize)
+            {
+                store_log(s, "B%lld(", blocks[currBlock].index);
+                int i;
+                //insert to blocksize - 1
+                for (i = 0; i < blockSize - 1 && filePos < fileSize; i++)
+                {
+                    blocks[currBlock].entries[i] = fileContents[filePos];
+                    store_indexEntry(s, fileContents[filePos], blocks[currBlock].index, fileName);
+                    store_log(s, "%d ", fileContents[filePos]);
+                    filePos++;
+                }
+                //If next block is null means it is the last block
+                if (currBlock < availableBlocks - 1)
+                {
+                    //if nextBlock index not currBlock index+1, it is not contiguous set entry as the pointer to next block else set to content
+                    if (blocks[currBlock + 1].index != blocks[currBlock].index + 1)
+                    {
+                        blocks[currBlock].entries[i] = linkedcontig_pointer(blocks[currBlock + 1].index);
+                        store_log(s, "%lld ", blocks[currBlock + 1].index);
+                    }
+                    else
+                    {
+                        blocks[currBlock].entries[i] = fileContents[filePos];
+                        store_indexEntry(s, fileContents[filePos], blocks[currBlock].index, fileName);
+                        store_log(s, "%d ", fileContents[filePos]);
+                        filePos++;
+                    }
+                    store_log(s, "), ");
+                    currBlock++;
+                }
+                else if (filePos < fileSize)
+                {
+                    blocks[currBlock].entries[i] = fileContents[filePos];
+                    store_indexEntry(s, fileContents[filePos], blocks[currBlock].index, fileName);
+                    store_log(s, "%d ", fileContents[filePos]);
+                    filePos++;
+                }
+            }
+            store_log(s, ")\n");
+            free(blocks);
+        }
+    }
+    return STATUS_OK;
+}
+
+// the indexed file whose index or indirect blocks point at content block, or NULL when it is not a content block
+static FileEntry *indexed_findOwner(Store *s, BlockNo block, int *reads)
+{
+    for (int i = 0; i < s->fileEntrySize; i++)
+    {
+        FileEntry *fe = s->fileEntry + i;
+        if (fe->fileName == 0 || fe->params[0] == -1)
+        {
+            continue;
+        }
+        Block indexBlock = store_getBlock(s, fe->params[0]);
+        BlockNo contentBlocks = fe->params[1];
+        for (BlockNo y = 0; y < contentBlocks; y++)
+        {
+            (*reads)++;
+            int *slot = indexed_slot(s, indexBlock, contentBlocks, y, 0, reads);
+            if (slot != NULL && *slot == block)
+            {
+                return fe;
+            }
+        }
+    }
+    return NULL;
+}
+
+// finds content in indexed files file by file, since packed blocks cannot be searched word by word
+// a packed block costs a read per word it decodes from
+static int indexed_scanContent(Store *s, int fileName)
+{
+    int blockSize = s->vcb->blockSize;
+    int *entries = malloc(sizeof(int) * blockSize * 32);
+    int reads = 0;
+    int status = STATUS_NOT_FOUND;
+    for (int i = 0; i < s->fileEntrySize && status != STATUS_OK; i++)
+    {
+        FileEntry *fe = s->fileEntry + i;
+        if (fe->fileName == 0 || fe->allocationType != ALLOC_INDEXED || fe->params[0] == -1)
+        {
+            continue;
+        }
+        int perBlock = indexed_perBlock(blockSize, fe);
+        Block indexBlock = store_getBlock(s, fe->params[0]);
+        reads++;
+        for (BlockNo k = 0; k * perBlock < fe->fileSize && status != STATUS_OK; k++)
+        {
+            BlockNo block = *indexed_slot(s, indexBlock, fe->params[1], k, 0, &reads);
+            int count = fe->fileSize - k * perBlock < perBlock ? fe->fileSize - k * perBlock : perBlock;
+            Block b = store_getBlock(s, block);
+            const int *values = b.entries;
+            if (fe->packedBits != 0)
+            {
+                packed_decode(b.entries, blockSize, fe->packedBits, 0, count, entries);
+                values = entries;
+                reads += blockSize;
+            }
+            for (int y = 0; y < count; y++)
+            {
+                reads += fe->packedBits == 0;
+                if (values[y] == fileName)
+                {
+                    store_log(s, "Read file %d(%d) from block %lld\n", fe->fileName, fileName, block);
+                    status = STATUS_OK;
+                    break;
+                }
+            }
+        }
+    }
+    free(entries);
+    if (status != STATUS_OK)
+    {
+        store_log(s, "File with name and content of %d is not found\n", fileName);
+    }
+    s->reads += reads;
+    store_log(s, "Time = %d reads\n", reads);
+    return status;
+}
+
+int store_read(Store *s, int allocationType, int fileName)
+{
+    int status = STATUS_NOT_FOUND;
+    if (allocationType == ALLOC_CONTIGUOUS || allocationType == ALLOC_BUDDY)
+    {
+        BlockNo blockSize = -1;
+        BlockNo blockIndex = -1;
+        int reads = 0;
+
+        //find the block Index and block Size
+        FileEntry *fe = store_lookupFile(s, fileName);
+        reads++;
+        if (fe != NULL)
+        {
+            blockIndex = fe->params[0];
+            blockSize = fe->params[1];
+            status = STATUS_OK;
+        }
+
+        // if block size and block index does not exist
+        if (blockSize == -1 && blockIndex == -1 && s->contentIndex != NULL)
+        {
+            //the content index knows the block and its owner directly
+            ContentPosting *posting = contentIndex_find(s->contentIndex, fileName);
+            reads++;
+            if (posting != NULL)
+            {
+                store_log(s, "Read %d(%d) from %lld\n", posting->owner, fileName, posting->block);
+                status = STATUS_OK;
+            }
+        }
+        else if (blockSize == -1 && blockIndex == -1)
+        {
+            //loop through the entire program entries
+            size_t i;
+            for (i = 0; i < (size_t)s->numBlocks * s->vcb->blockSize; ++i)
+            {
+                //if entries is fileName
+                if (s->data[i] == fileName)
+                {
+                    blockIndex = i / s->vcb->blockSize;
+                    if (i % s->vcb->blockSize > 0)
+                    {
+                        blockIndex++;
+                    }
+                    //find the block in range in file entry
+                    for (int j = 0; j < s->fileEntrySize; ++j)
+                    {
+                        reads++;
+                        if (blockIndex >= s->fileEntry[j].params[0] && blockIndex <= s->fileEntry[j].params[0] + s->fileEntry[j].params[1])
+                        {
+                            store_log(s, "Read %d(%d) from %lld\n", s->fileEntry[j].fileName, fileName, blockIndex - 1);
+                            status = STATUS_OK;
+                            break;
+                        }
+                    }
+                    break;
+                }
+            }
+            store_touchRange(s, 0, i / s->vcb->blockSize + 1);
+        }
+        for (BlockNo i = 0; i < blockSize; ++i)
+        {
+            Block readBlock = store_getBlock(s, i + blockIndex);
+            for (int j = 0; j < s->vcb->blockSize; ++j)
+            {
+                store_log(s, "Block read: %d \n", readBlock.entries[j]);
+            }
+        }
+        s->reads += reads;
+        store_log(s, "Time = %d reads\n", reads);
+    }
+    else if (allocationType == ALLOC_LINKED && s->fat != NULL)
+    {
+        return fat_read(s, fileName);
+    }
+    else if (allocationType == ALLOC_LINKED)
+    {
+        //Find actual file name
+        int fileActual = (fileName / 100) * 100;
+        BlockNo start = -1;
+        BlockNo end = -1;
+        int reads = 1;
+        FileEntry *fe = store_lookupFile(s, fileActual);
+        if (fe != NULL)
+        {
+            start = fe->params[0];
+            end = fe->params[1];
+        }
+        if (start == -1)
+        {
+            store_log(s, "File%d not found\n", fileName);
+        }
+        else if (fileName == fileActual)
+        {
+            store_log(s, "File %d found", fileName);
+            status = STATUS_OK;
+        }
+        else
+        {
+            Block b = store_getBlock(s, start);
+            int found = 0;
+            int blockSize = s->vcb->blockSize;
+
+            //find block that contains filename
+            while (1)
+            {
+                //search block for filename
+                store_log(s, "Reading B%lld(", b.index);
+                for (int i = 0; i < blockSize; i++)
+                {
+                    reads++;
+                    if (b.entries[i] != -1)
+                    {
+                        store_log(s, "%d ", b.entries[i]);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                    if (b.entries[i] == fileName)
+                    {
+                        store_log(s, ")\n");
+                        store_log(s, "File%d(%d) found in B%lld\n", fileActual, fileName, b.index);
+                        found = 1;
+                        status = STATUS_OK;
+                        break;
+                    }
+                }
+                if (found == 1)
+                    break;
+                if (b.index != end)
+                {
+                    store_log(s, "), ");
+                    b = store_getBlock(s, b.entries[blockSize - 1]);
+                    reads++;
+                }
+                else
+                    break;
+            }
+            if (found == 0)
+            {
+                store_log(s, ")\nFile%d not found\n", fileName);
+            }
+            s->reads += reads;
+            store_log(s, "Time = %d reads\n", reads);
+        }
+    }
+    else if (allocationType == ALLOC_INDEXED)
+    {
+        // try to find the fileEntry with fileName
+        FileEntry *fileEntry = store_lookupFile(s, fileName);
+
+        // fileName found
+        if (fileEntry != NULL)
+        {
+            store_log(s, "Read file %d(%d) from directory structure\n", fileName, fileName);
+            return STATUS_OK;
+        }
+
+        // not found, the content index answers without scanning
+        if (s->contentIndex != NULL)
+        {
+            ContentPosting *posting = contentIndex_find(s->contentIndex, fileName);
+            if (posting == NULL)
+            {
+                store_log(s, "File with name and content of %d is not found\n", fileName);
+            }
+            else
+            {
+                store_log(s, "Read file %d(%d) from block %lld\n", posting->owner, fileName, posting->block);
+                status = STATUS_OK;
+            }
+            s->reads += 1;
+            store_log(s, "Time = %d reads\n", 1);
+            return status;
+        }
+
+        if (s->compress)
+        {
+            return indexed_scanContent(s, fileName);
+        }
+
+        // not found try to find from content
+        // a match in an index or indirect block is only a block number, the scan goes on past it
+        int blockSize = s->vcb->blockSize;
+        size_t entriesSize = (size_t)s->numBlocks * blockSize;
+        const int *entries = s->data;
+        long long entryIndex = -1;
+        FileEntry *owner = NULL;
+        int reads = 0;
+        for (size_t i = 0; i < entriesSize && owner == NULL; i++)
+        {
+            reads++;
+            if (entries[i] == fileName)
+            {
+                entryIndex = i;
+                owner = indexed_findOwner(s, entryIndex / blockSize, &reads);
+            }
+        }
+        store_touchRange(s, 0, owner == NULL ? s->numBlocks : entryIndex / blockSize + 1);
+
+        if (owner == NULL)
+        {
+            store_log(s, "File with name and content of %d is not found\n", fileName);
+            s->reads += reads;
+            store_log(s, "Time = %d reads\n", reads);
+            return STATUS_NOT_FOUND;
+        }
+
+        // Read file100(106) from <you will decide how it can be processed>
+        store_log(s, "Read file %d(%d) from block %lld\n", owner->fileName, fileName, entryIndex / blockSize);
+        status = STATUS_OK;
+        s->reads += reads;
+        store_log(s, "Time = %d reads\n", reads);
+    }
+    else if (allocationType == ALLOC_LINKEDCONTIG)
+    {
+        int fileActual = (fileName / 100) * 100;
+        BlockNo start = -1;
+        BlockNo end = -1;
+        int reads = 1;
+        FileEntry *fe = store_lookupFile(s, fileActual);
+        if (fe != NULL)
+        {
+            start = fe->params[0];
+            end = fe->params[1];
+        }
+        if (start == -1)
+        {
+            store_log(s, "File%d not found\n", fileName);
+            return STATUS_NOT_FOUND;
+        }
+        else if (fileName == fileActual)
+        {
+            store_log(s, "File %d found\n", fileName);
+            status = STATUS_OK;
+        }
+        else
+        {
+            Block b = store_getBlock(s, start);
+            int found = 0;
+            int blockSize = s->vcb->blockSize;
+
+            //find block that contains filename
+            while (1)
+            {
+                //search block for filename
+                store_log(s, "Reading B%lld(", b.index);
+                for (int i = 0; i < blockSize; i++)
+                {
+                    reads++;
+                    if (linkedcontig_isPointer(b.entries[i]))
+                    {
+                        store_log(s, "%lld ", linkedcontig_target(b.entries[i]));
+                    }
+                    else if (b.entries[i] != -1)
+                    {
+                        store_log(s, "%d ", b.entries[i]);
+                    }
+                    else
+                    {
+                        break;
+                    }
+                    if (b.entries[i] == fileName)
+                    {
+                        store_log(s, ")\n");
+                        store_log(s, "File%d(%d) found in B%lld\n", fileActual, fileName, b.index);
+                        found = 1;
+                        status = STATUS_OK;
+                        break;
+                    }
+                }
+                if (found == 1)
+                    break;
+                if (b.index != end)
+                {
+                    store_log(s, "), ");
+                    if (linkedcontig_isPointer(b.entries[blockSize - 1]))
+                    {
+                        b = store_getBlock(s, linkedcontig_target(b.entries[blockSize - 1]));
+                    }
+                    else
+                    {
+                        b = store_getBlock(s, b.index + 1);
+                    }
+                    reads++;
+                }
+                else
+                    break;
+            }
+            if (found == 0)
+            {
+                store_log(s, ")\nFile%d not found\n", fileName);
+            }
+            s->reads += reads;
+            store_log(s, "Time = %d reads\n", reads);
+        }
+    }
+    return status;
+}
+
+int store_delete(Store *s, int allocationType, int fileName)
+{
+    if (fileName % 100 != 0)
+    {
+        fileName = (fileName / 100) * 100;
+    }
+    if (allocationType == ALLOC_CONTIGUOUS || allocationType == ALLOC_BUDDY)
+    {
+
+        BlockNo blockIndex = -1;
+        BlockNo requiredBlocks = -1;
+        //find the file entry where file is stored
+        FileEntry *fileEntry = store_lookupFile(s, fileName);
+        if (fileEntry != NULL)
+        {
+            blockIndex = fileEntry->params[0];
+            requiredBlocks = fileEntry->params[1];
+            if (blockIndex != -1 && requiredBlocks != -1 && blockIndex < s->numBlocks)
+            {
+                //clear every block of the file, then free them as one run
+                for (BlockNo i = 0; i < requiredBlocks; i++)
+                {
+                    Block deleteBlock = store_getBlockToFree(s, blockIndex + i);
+                    store_unindexBlock(s, deleteBlock, fileName);
+                    if (!store_snapshotSees(s, blockIndex + i))
+                    {
+                        block_clear(&deleteBlock, s->vcb->blockSize);
+                    }
+                }
+                store_freeRun(s, blockIndex, requiredBlocks);
+            }
+            //set the file entry parameters back to 0
+            store_releaseFileEntry(s, fileEntry);
+            store_log(s, "Deleted file %d and freed B%lld \n", fileName, blockIndex);
+        }
+        else
+        {
+            store_log(s, "No file found \n");
+            return STATUS_NOT_FOUND;
+        }
+    }
+    else if (allocationType == ALLOC_LINKED && s->fat != NULL)
+    {
+        return fat_delete(s, fileName);
+    }
+    else if (allocationType == ALLOC_LINKED)
+    {
+        BlockNo start = -1;
+        BlockNo end = -1;
+        //Find file entry that contains filename and set the start and end
+        FileEntry *fe = store_lookupFile(s, fileName);
+        if (fe != NULL)
+        {
+            start = fe->params[0];
+            end = fe->params[1];
+        }
+        if (start == -1)
+        {
+            store_log(s, "File%d not found", fileName);
+            return STATUS_NOT_FOUND;
+        }
+        else
+        {
+            //clear the filentry data
+            store_releaseFileEntry(s, fe);
+            store_log(s, "Deleted file %d and freed ", fileName);
+            int blockSize = s->vcb->blockSize;
+            BlockNo temp = start;
+            Block b;
+            //free the blocks from start to end
+            do
+            {
+                b = store_getBlockToFree(s, temp);
+                temp = b.entries[blockSize - 1];
+                store_unindexBlock(s, b, fileName);
+                vcb_freeBlock(s->vcb, &b);
+                store_log(s, "B%lld ", b.index);
+            } while (b.index != end);
+            store_log(s, "\n");
+        }
+    }
+    else if (allocationType == ALLOC_INDEXED)
+    {
+        BlockNo indexBlock = -1;
+        FileEntry *fileEntry = store_lookupFile(s, fileName);
+        //finds the filename
+        if (fileEntry != NULL)
+        {
+            indexBlock = fileEntry->params[0];
+            if (indexBlock != -1)
+            {
+                int blockSize = s->vcb->blockSize;
+                BlockNo contentBlocks = fileEntry->params[1];
+                // a file that outgrew its index block keeps indirect pointers in the last slots
+                int direct = contentBlocks <= blockSize ? blockSize : blockSize - indexed_indirectSlots(blockSize);
+                indexed_unindexPacked(s, fileEntry);
+                Block deleteBlockIndex = store_getBlockToFree(s, indexBlock); //get the block that contains the index
+                for (int y = 0; y < blockSize; y++)
+                {
+                    int contentBlockIndex = deleteBlockIndex.entries[y];
+                    if (contentBlockIndex == -1)
+                    {
+                        break;
+                    }
+                    //get the block that contains the data, or the indirect blocks above it
+                    indexed_freeTree(s, contentBlockIndex, y < direct ? 0 : y - direct + 1, fileEntry);
+                }
+                //clearing the Volume Control Block
+                VolumeControlBlock *deleteVCB = s->vcb;
+                vcb_freeBlock(deleteVCB, &deleteBlockIndex);
+
+                store_releaseFileEntry(s, fileEntry);
+                store_log(s, "Deleted file %d and freed B%lld \n", fileName, indexBlock);
+            }
+        }
+        else
+        {
+            store_log(s, "File %d is not found!\n", fileName);
+            return STATUS_NOT_FOUND;
+        }
+    }
+    else if (allocationType == ALLOC_LINKEDCONTIG)
+    {
+        BlockNo start = -1;
+        BlockNo end = -1;
+        //Find file entry that contains filename and set the start and end
+        FileEntry *fe = store_lookupFile(s, fileName);
+        if (fe != NULL)
+        {
+            start = fe->params[0];
+            end = fe->params[1];
+        }
+        if (start == -1)
+        {
+            store_log(s, "File%d not found\n", fileName);
+            return STATUS_NOT_FOUND;
+        }
+        store_releaseFileEntry(s, fe);
+        store_log(s, "Deleted file %d and freed ", fileName);
+        int blockSize = s->vcb->blockSize;
+        BlockNo temp = start;
+        Block b;
+        do
+        {
+            b = store_getBlockToFree(s, temp);
+            if (linkedcontig_isPointer(b.entries[blockSize - 1]))
+            {
+                temp = linkedcontig_target(b.entries[blockSize - 1]);
+            }
+            else
+            {
+                temp = b.index + 1;
+            }
+            store_unindexBlock(s, b, fileName);
+            vcb_freeBlock(s->vcb, &b);
+            store_log(s, "B%lld ", b.index);
+        } while (b.index != end);
+        store_log(s, "\n");
+    }
+    return STATUS_OK;
+}
+
+void store_print(Store *store)
+{
+    if (!store->output.verbose)
+    {
+        return;
+    }
+    store_log(store, "%20s%20s%20s\n", "Index", "Block", "File Data");
+    store_log(store, "%20s%20s%20s\n", "0", "-", "<v.ctrl B>");
+    int i, y;
+    char fileEntryStr[100] = "\0";
+    for (i = 0; i < store->fileEntrySize; i++)
+    {
+        if (store->fileEntry[i].allocationType == ALLOC_INDEXED)
+        {
+            sprintf(fileEntryStr, "%d,%lld", store->fileEntry[i].fileName, store->fileEntry[i].params[0]);
+        }
+        else
+        {
+            sprintf(fileEntryStr, "%d,%lld,%lld", store->fileEntry[i].fileName, store->fileEntry[i].params[0], store->fileEntry[i].params[1]);
+        }
+        store_log(store, "%20d%20s%20s\n", 1 + i, "-", fileEntryStr);
+    }
+
+    // linked contiguous pointers are shown as the block they point at
+    int linkedContig = store->fileEntrySize > 0 && store->fileEntry[0].allocationType == ALLOC_LINKEDCONTIG;
+    for (BlockNo b = 0; b < store->numBlocks; b++)
+    {
+        Block block = store_blockView(store, b);
+        for (y = 0; y < store->vcb->blockSize; y++)
+        {
+            long long index = store->fileEntrySize + 1 + y + b * store->vcb->blockSize;
+            int entry = block.entries[y];
+            if (linkedContig && linkedcontig_isPointer(entry))
+            {
+                store_log(store, "%20lld%20lld%20lld\n", index, block.index, linkedcontig_target(entry));
+            }
+            else
+            {
+                store_log(store, "%20lld%20lld%20d\n", index, block.index, entry);
+            }
+        }
+    }
+    if (store->fat != NULL)
+    {
+        store_log(store, "%20s%20s\n", "FAT Block", "Next");
+        for (BlockNo b = 0; b < store->numBlocks; b++)
+        {
+            store_log(store, "%20lld%20d\n", b, store->fat[b]);
+        }
+    }
+}
+
+// content entries in a block of a linked or linked contiguous file, and the block after it
+static int chain_step(Store *s, FileEntry *fe, BlockNo block, BlockNo blockOffset, BlockNo *next)
+{
+    int blockSize = s->vcb->blockSize;
+    Block b = store_getBlock(s, block);
+    if (block == fe->params[1])
+    {
+        *next = -1;
+        return fe->fileSize - blockOffset;
+    }
+    if (fe->allocationType == ALLOC_LINKED && s->fat != NULL)
+    {
+        *next = s->fat[block];
+        return blockSize;
+    }
+    if (fe->allocationType == ALLOC_LINKED)
+    {
+        *next = b.entries[blockSize - 1];
+        return blockSize - 1;
+    }
+    // linked contiguous only stores a pointer when the next block is not adjacent, read as store_read does
+    if (linkedcontig_isPointer(b.entries[blockSize - 1]))
+    {
+        *next = linkedcontig_target(b.entries[blockSize - 1]);
+        return blockSize - 1;
+    }
+    *next = block + 1;
+    return blockSize;
+}
+
+// copies entries [offset, offset + length) of a file to out
+// returns the number copied, fewer at the end of the file, or -1 when there is no such file
+long long store_read_range(Store *s, int fileName, long long offset, long long length, int *out)
+{
+    FileEntry *fe = store_lookupFile(s, fileName);
+    if (fe == NULL)
+    {
+        return -1;
+    }
+    if (offset < 0 || length <= 0 || offset >= fe->fileSize)
+    {
+        return 0;
+    }
+    if (length > fe->fileSize - offset)
+    {
+        length = fe->fileSize - offset;
+    }
+    int blockSize = s->vcb->blockSize;
+
+    if (fe->allocationType == ALLOC_CONTIGUOUS || fe->allocationType == ALLOC_BUDDY)
+    {
+        // the blocks are adjacent and so is their content, unless a snapshot keeps copies of some of them
+        store_touchRange(s, fe->params[0] + offset / blockSize, (offset + length - 1) / blockSize - offset / blockSize + 1);
+        if (s->view == NULL)
+        {
+            memcpy(out, store_blockView(s, fe->params[0]).entries + offset, sizeof(int) * length);
+        }
+        for (long long at = offset; s->view != NULL && at < offset + length; at += blockSize - at % blockSize)
+        {
+            long long n = blockSize - at % blockSize < offset + length - at ? blockSize - at % blockSize : offset + length - at;
+            memcpy(out + (at - offset), store_blockView(s, fe->params[0] + at / blockSize).entries + at % blockSize, sizeof(int) * n);
+        }
+        s->reads += (offset + length - 1) / blockSize - offset / blockSize + 1;
+        return length;
+    }
+
+    int reads = 1;
+    long long copied = 0;
+    if (fe->allocationType == ALLOC_INDEXED && fe->packedBits != 0)
+    {
+        // packed blocks are unpacked straight into out
+        Block indexBlock = store_getBlock(s, fe->params[0]);
+        int perBlock = packed_capacity(blockSize, fe->packedBits);
+        while (copied < length)
+        {
+            long long at = offset + copied;
+            Block b = store_getBlock(s, *indexed_slot(s, indexBlock, fe->params[1], at / perBlock, 0, &reads));
+            reads++;
+            long long n = perBlock - at % perBlock < length - copied ? perBlock - at % perBlock : length - copied;
+            packed_decode(b.entries, blockSize, fe->packedBits, at % perBlock, n, out + copied);
+            copied += n;
+        }
+        s->reads += reads;
+        return length;
+    }
+    if (fe->allocationType == ALLOC_INDEXED)
+    {
+        Block indexBlock = store_getBlock(s, fe->params[0]);
+        BlockNo contentBlocks = fe->params[1];
+        // content blocks that are next to each other are copied as one run
+        int *run = NULL;
+        long long runLength = 0;
+        while (copied + runLength < length)
+        {
+            long long at = offset + copied + runLength;
+            Block b = store_getBlock(s, *indexed_slot(s, indexBlock, contentBlocks, at / blockSize, 0, &reads));
+            reads++;
+            int *from = b.entries + at % blockSize;
+            long long n = blockSize - at % blockSize;
+            if (n > length - copied - runLength)
+            {
+                n = length - copied - runLength;
+            }
+            if (from != run + runLength)
+            {
+                if (runLength > 0)
                 {
-                    s->fileEntry[k].allocationType = allocationType;
-                    s->fileEntry[k].fileName = fileName;
-                    s->fileEntry[k].params[0] = i;
-                    s->fileEntry[k].params[1] = blocksRequired;
-                    break;
+                    memcpy(out + copied, run, sizeof(int) * runLength);
                 }
+                copied += runLength;
+                run = from;
+                runLength = 0;
+            }
+            runLength += n;
+        }
+        memcpy(out + copied, run, sizeof(int) * runLength);
+        s->reads += reads;
+        return length;
+    }
+
+    // chained files start from the cached position when it is not past the offset
+    ChainCursor *cursor = s->cursors + dir_hash(fileName) % CURSOR_SLOTS;
+    BlockNo block = fe->params[0];
+    BlockNo blockOffset = 0;
+    if (s->locks != NULL)
+    {
+        pthread_mutex_lock(&s->locks->sharedLock);
+    }
+    if (cursor->fileName == fileName && cursor->offset <= offset)
+    {
+        block = cursor->block;
+        blockOffset = cursor->offset;
+    }
+    if (s->locks != NULL)
+    {
+        pthread_mutex_unlock(&s->locks->sharedLock);
+    }
+    while (block != -1)
+    {
+        BlockNo next;
+        int count = chain_step(s, fe, block, blockOffset, &next);
+        reads++;
+        if (offset + copied < blockOffset + count)
+        {
+            long long from = offset + copied - blockOffset;
+            long long n = count - from < length - copied ? count - from : length - copied;
+            // chain_step already went through the cache for this block
+            memcpy(out + copied, store_blockView(s, block).entries + from, sizeof(int) * n);
+            copied += n;
+            if (copied == length)
+            {
+                break;
+            }
+        }
+        block = next;
+        blockOffset += count;
+    }
+    if (block != -1)
+    {
+        if (s->locks != NULL)
+        {
+            pthread_mutex_lock(&s->locks->sharedLock);
+        }
+        cursor->fileName = fileName;
+        cursor->offset = blockOffset;
+        cursor->block = block;
+        if (s->locks != NULL)
+        {
+            pthread_mutex_unlock(&s->locks->sharedLock);
+        }
+    }
+    s->reads += reads;
+    return copied;
+}
+
+// makes a contiguous or buddy file hold entries, over the blocks after it when they are free
+// otherwise the file moves to a run placed as an add of its new size would be
+static int contiguous_reserve(Store *s, FileEntry *fe, BlockNo entries)
+{
+    int blockSize = s->vcb->blockSize;
+    BlockNo start = fe->params[0];
+    BlockNo count = fe->params[1];
+    BlockNo needed = entries > 0 ? (entries + blockSize - 1) / blockSize : 1;
+    if (needed <= count)
+    {
+        return STATUS_OK;
+    }
+    BlockNo extended = count;
+    if (s->buddy != NULL)
+    {
+        extended = buddy_extend(s->buddy, start, count, needed);
+    }
+    else if (start + needed <= s->numBlocks)
+    {
+        extended = needed;
+        for (BlockNo b = start + count; b < start + needed && extended == needed; b++)
+        {
+            extended = vcb_isFree(s->vcb, b) ? needed : count;
+        }
+    }
+    if (extended > count)
+    {
+        vcb_useRange(s->vcb, start + count, extended - count);
+        fe->params[1] = extended;
+        journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+        store_log(s, "Extended file%d in place to B%lld\n", fe->fileName, start + extended - 1);
+        return STATUS_OK;
+    }
+
+    if (s->vcb->freeBlockNum < needed)
+    {
+        store_log(s, "Not enough space to grow file%d\n", fe->fileName);
+        return STATUS_NO_SPACE;
+    }
+    BlockNo traversals = 0;
+    BlockNo target = s->buddy != NULL ? buddy_allocate(s->buddy, &needed, &traversals) : vcb_findFreeRun(s->vcb, needed, &traversals);
+    s->traversals += traversals;
+    store_log(s, "%lld Traversals to find blocks\n", traversals);
+    if (target == -1)
+    {
+        store_log(s, "No contiguous space found to grow file%d\n", fe->fileName);
+        return STATUS_NO_SPACE;
+    }
+    vcb_useRange(s->vcb, target, needed);
+    for (BlockNo i = 0; i < count; i++)
+    {
+        Block from = store_getBlockToFree(s, start + i);
+        Block to = store_getBlockForWrite(s, target + i);
+        store_unindexBlock(s, from, fe->fileName);
+        memcpy(to.entries, from.entries, sizeof(int) * blockSize);
+        if (!store_snapshotSees(s, start + i))
+        {
+            block_clear(&from, blockSize);
+        }
+        for (int j = 0; j < blockSize; j++)
+        {
+            if (to.entries[j] != -1)
+            {
+                store_indexEntry(s, to.entries[j], to.index, fe->fileName);
+            }
+        }
+    }
+    store_freeRun(s, start, count);
+    fe->params[0] = target;
+    fe->params[1] = needed;
+    journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+    store_log(s, "Moved file%d from B%lld to B%lld to grow it\n", fe->fileName, start, target);
+    return STATUS_OK;
+}
+
+// entries a block of a linked or linked contiguous file can hold, the last block of the chain has no pointer to keep
+static int chain_capacity(Store *s, FileEntry *fe, BlockNo block, BlockNo *next)
+{
+    if (block == fe->params[1])
+    {
+        *next = -1;
+        return s->vcb->blockSize;
+    }
+    return chain_step(s, fe, block, 0, next);
+}
+
+// links the free block nearest after the last one onto a linked or linked contiguous file
+// a pointer in the old last block takes its last slot, moving the entry there to the new block
+static void chain_extend(Store *s, FileEntry *fe)
+{
+    int blockSize = s->vcb->blockSize;
+    BlockNo tail = fe->params[1];
+    BlockNo block = store_findFreeBlockNear(s, tail + 1);
+    vcb_useBlock(s->vcb, block);
+    Block added = store_getBlockForWrite(s, block);
+    if (fe->allocationType == ALLOC_LINKED && s->fat != NULL)
+    {
+        s->fat[tail] = block;
+        journal_note(s->vcb->journal, JOURNAL_FAT, tail);
+    }
+    // a linked contiguous block runs on into its neighbour without a pointer
+    else if (fe->allocationType == ALLOC_LINKED || block != tail + 1)
+    {
+        Block last = store_getBlockForWrite(s, tail);
+        int *slot = last.entries + blockSize - 1;
+        if (*slot != -1)
+        {
+            added.entries[0] = *slot;
+            if (s->contentIndex != NULL)
+            {
+                contentIndex_remove(s->contentIndex, *slot, tail, fe->fileName);
+            }
+            store_indexEntry(s, *slot, block, fe->fileName);
+        }
+        *slot = fe->allocationType == ALLOC_LINKED ? block : linkedcontig_pointer(block);
+    }
+    fe->params[1] = block;
+    journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+}
+
+// makes a linked or linked contiguous file hold entries, adding blocks after its last one
+static int chain_reserve(Store *s, FileEntry *fe, BlockNo entries)
+{
+    int blockSize = s->vcb->blockSize;
+    BlockNo capacity = 0;
+    BlockNo next;
+    for (BlockNo block = fe->params[0]; block != -1; block = next)
+    {
+        capacity += chain_capacity(s, fe, block, &next);
+    }
+    if (capacity >= entries)
+    {
+        return STATUS_OK;
+    }
+    // each new block gives at least a block less the pointer it costs
+    int perBlock = fe->allocationType == ALLOC_LINKED && s->fat != NULL ? blockSize : blockSize - 1;
+    if (perBlock < 1 || (entries - capacity + perBlock - 1) / perBlock > s->vcb->freeBlockNum)
+    {
+        store_log(s, "Not enough space to grow file%d\n", fe->fileName);
+        return STATUS_NO_SPACE;
+    }
+    while (capacity < entries)
+    {
+        // the old last block gives up a slot when it now holds a pointer, the new one holds a full block
+        BlockNo tail = fe->params[1];
+        capacity -= blockSize;
+        chain_extend(s, fe);
+        capacity += chain_capacity(s, fe, tail, &next) + blockSize;
+    }
+    return STATUS_OK;
+}
+
+// makes an indexed file hold entries, new content blocks go after its last one
+// the slots past the direct pointers become indirect ones once the file outgrows its index block
+static int indexed_reserve(Store *s, FileEntry *fe, BlockNo entries)
+{
+    int blockSize = s->vcb->blockSize;
+    BlockNo held = fe->params[1];
+    BlockNo needed = (entries + blockSize - 1) / blockSize;
+    if (needed <= held)
+    {
+        return STATUS_OK;
+    }
+    if (needed > indexed_capacity(blockSize) ||
+        needed - held + indexed_metaBlocks(blockSize, needed) - indexed_metaBlocks(blockSize, held) > s->vcb->freeBlockNum)
+    {
+        store_log(s, "Not enough space to grow file%d\n", fe->fileName);
+        return STATUS_NO_SPACE;
+    }
+    Block indexBlock = store_getBlockForWrite(s, fe->params[0]);
+    int reads = 0;
+    int direct = blockSize - indexed_indirectSlots(blockSize);
+    if (held <= blockSize && needed > blockSize)
+    {
+        BlockNo spilled[3];
+        for (BlockNo k = direct; k < held; k++)
+        {
+            spilled[k - direct] = indexBlock.entries[k];
+            indexBlock.entries[k] = -1;
+        }
+        for (BlockNo k = direct; k < held; k++)
+        {
+            *indexed_slot(s, indexBlock, needed, k, 1, &reads) = spilled[k - direct];
+        }
+    }
+    BlockNo last = held > 0 ? *indexed_slot(s, indexBlock, needed, held - 1, 0, &reads) : fe->params[0];
+    for (BlockNo k = held; k < needed; k++)
+    {
+        last = store_findFreeBlockNear(s, last + 1);
+        vcb_useBlock(s->vcb, last);
+        *indexed_slot(s, indexBlock, needed, k, 1, &reads) = last;
+    }
+    fe->params[1] = needed;
+    journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+    return STATUS_OK;
+}
+
+// makes fe hold entries of content without changing its size, returns one of the STATUS_ codes
+static int store_reserve(Store *s, FileEntry *fe, BlockNo entries)
+{
+    store_dropCursor(s, fe->fileName);
+    if (fe->allocationType == ALLOC_CONTIGUOUS || fe->allocationType == ALLOC_BUDDY)
+    {
+        return contiguous_reserve(s, fe, entries);
+    }
+    if (fe->allocationType == ALLOC_INDEXED)
+    {
+        return indexed_reserve(s, fe, entries);
+    }
+    return chain_reserve(s, fe, entries);
+}
+
+// adds count entries to the end of a file, growing it the way its allocation type places blocks
+// copies the blocks of a file that growing it may change while a snapshot sees them, before any of them changes:
+// the block holding its last entry, its last block or index block, and the indirect blocks leading to its last block
+// STATUS_NO_SPACE when the volume cannot take the copies
+static int store_preserveFile(Store *s, FileEntry *fe)
+{
+    SnapshotSet *set = s->vcb->snapshots;
+    if (set == NULL || set->newest == NULL)
+    {
+        return STATUS_OK;
+    }
+    int blockSize = s->vcb->blockSize;
+    BlockNo tail = -1;
+    BlockNo last = -1;
+    int levels = 0;
+    if (fe->allocationType == ALLOC_CONTIGUOUS || fe->allocationType == ALLOC_BUDDY)
+    {
+        tail = fe->fileSize > 0 ? fe->params[0] + (fe->fileSize - 1) / blockSize : -1;
+    }
+    else if (fe->allocationType == ALLOC_INDEXED)
+    {
+        Block indexBlock = store_getBlock(s, fe->params[0]);
+        last = fe->params[0];
+        if (fe->fileSize > 0)
+        {
+            tail = *indexed_slot(s, indexBlock, fe->params[1], (fe->fileSize - 1) / blockSize, 0, &levels);
+        }
+        levels = 0;
+        if (fe->params[1] > 0)
+        {
+            indexed_slot(s, indexBlock, fe->params[1], fe->params[1] - 1, 0, &levels);
+        }
+    }
+    else
+    {
+        BlockNo block = fe->params[0];
+        BlockNo blockOffset = 0;
+        BlockNo next;
+        int capacity = fe->fileSize > 0 ? chain_capacity(s, fe, block, &next) : 0;
+        while (fe->fileSize > blockOffset + capacity)
+        {
+            blockOffset += capacity;
+            block = next;
+            capacity = chain_capacity(s, fe, block, &next);
+        }
+        tail = fe->fileSize > 0 ? block : -1;
+        last = fe->params[1];
+    }
+    BlockNo needed = levels + (tail != -1 && snapshot_sees(set, tail)) + (last != -1 && last != tail && snapshot_sees(set, last));
+    if (s->vcb->freeBlockNum < needed)
+    {
+        store_log(s, "Not enough space to copy the blocks of file%d its snapshots share\n", fe->fileName);
+        return STATUS_NO_SPACE;
+    }
+    if (tail != -1)
+    {
+        snapshot_preserve(s, tail);
+    }
+    if (last != -1)
+    {
+        snapshot_preserve(s, last);
+    }
+    if (fe->allocationType == ALLOC_INDEXED && fe->params[1] > 0)
+    {
+        // walking to the last block for writing copies the indirect blocks on the way
+        indexed_slot(s, store_getBlock(s, fe->params[0]), fe->params[1], fe->params[1] - 1, 1, &levels);
+    }
+    return STATUS_OK;
+}
+
+// gives an indexed file its own copy of a partly filled last block it shares with other files, before an append fills it
+// a last block only it uses leaves the dedup index instead, as its entries are about to change
+static int store_dedupUnshare(Store *s, FileEntry *fe)
+{
+    int blockSize = s->vcb->blockSize;
+    if (s->dedup == NULL || fe->allocationType != ALLOC_INDEXED || fe->fileSize % blockSize == 0)
+    {
+        return STATUS_OK;
+    }
+    int reads = 0;
+    BlockNo k = (fe->fileSize - 1) / blockSize;
+    BlockNo tail = *indexed_slot(s, store_getBlock(s, fe->params[0]), fe->params[1], k, 0, &reads);
+    Block from = store_getBlock(s, tail);
+    if (s->dedup->refs[tail] <= 1)
+    {
+        store_dedupForget(s, from, fe->packedBits);
+        return STATUS_OK;
+    }
+    BlockNo copy = store_findFreeBlock(s);
+    if (copy == -1)
+    {
+        store_log(s, "Not enough space to copy the block file%d shares\n", fe->fileName);
+        return STATUS_NO_SPACE;
+    }
+    vcb_useBlock(s->vcb, copy);
+    Block to = store_getBlockForWrite(s, copy);
+    memcpy(to.entries, from.entries, sizeof(int) * blockSize);
+    store_unindexBlock(s, from, fe->fileName);
+    for (int y = 0; y < blockSize && to.entries[y] != -1; y++)
+    {
+        store_indexEntry(s, to.entries[y], copy, fe->fileName);
+    }
+    *indexed_slot(s, store_getBlockForWrite(s, fe->params[0]), fe->params[1], k, 1, &reads) = copy;
+    s->dedup->refs[tail]--;
+    s->dedup->unshared++;
+    store_log(s, "Copied B%lld that file%d shares to B%lld\n", tail, fe->fileName, copy);
+    return STATUS_OK;
+}
+
+// puts the content blocks first to last of an indexed file in the dedup index once an append has written them
+// a block with the same entries as one already there is shared instead, and its own copy freed, as an add would do
+static void store_dedupAppended(Store *s, FileEntry *fe, BlockNo first, BlockNo last)
+{
+    int blockSize = s->vcb->blockSize;
+    int reads = 0;
+    for (BlockNo k = first; k <= last; k++)
+    {
+        BlockNo block = *indexed_slot(s, store_getBlock(s, fe->params[0]), fe->params[1], k, 0, &reads);
+        Block b = store_getBlock(s, block);
+        uint64_t fingerprint = dedup_fingerprint(b.entries, blockSize, fe->packedBits);
+        BlockNo match = store_dedupFind(s, b.entries, fingerprint);
+        if (match == -1)
+        {
+            s->dedup->refs[block] = 1;
+            s->dedup->written++;
+            dedup_add(s->dedup, fingerprint, block);
+            continue;
+        }
+        store_unindexBlock(s, b, fe->fileName);
+        for (int y = 0; y < blockSize && b.entries[y] != -1; y++)
+        {
+            store_indexEntry(s, b.entries[y], match, fe->fileName);
+        }
+        *indexed_slot(s, store_getBlockForWrite(s, fe->params[0]), fe->params[1], k, 1, &reads) = match;
+        s->dedup->refs[match]++;
+        s->dedup->shared++;
+        s->dedup->refs[block] = 0;
+        Block freed = store_getBlockToFree(s, block);
+        vcb_freeBlock(s->vcb, &freed);
+        store_log(s, "File%d shares B%lld instead of B%lld\n", fe->fileName, match, block);
+    }
+}
+
+// rewrites a packed indexed file with plain entries before it grows, appends write entries where they belong
+// the file is deleted and added again, so *fe is looked up afresh, and it is packed again if the plain add fails
+static int store_unpackFile(Store *s, FileEntry **fe)
+{
+    if ((*fe)->allocationType != ALLOC_INDEXED || (*fe)->packedBits == 0)
+    {
+        return STATUS_OK;
+    }
+    int blockSize = s->vcb->blockSize;
+    int fileName = (*fe)->fileName;
+    int fileSize = (*fe)->fileSize;
+    BlockNo contentBlocks = (fileSize + blockSize - 1) / blockSize;
+    if (contentBlocks > indexed_capacity(blockSize) ||
+        contentBlocks + indexed_metaBlocks(blockSize, contentBlocks) > s->vcb->freeBlockNum)
+    {
+        store_log(s, "Not enough space to unpack file%d\n", fileName);
+        return STATUS_NO_SPACE;
+    }
+    int *contents = malloc(sizeof(int) * (fileSize + 1));
+    store_read_range(s, fileName, 0, fileSize, contents);
+    int verbose = s->output.verbose;
+    int compress = s->compress;
+    s->output.verbose = 0;
+    s->compress = 0;
+    store_delete(s, ALLOC_INDEXED, fileName);
+    int status = store_add(s, ALLOC_INDEXED, fileName, fileSize, contents);
+    if (status != STATUS_OK)
+    {
+        // the packed copy fits in the blocks the delete just freed
+        s->compress = 1;
+        store_add(s, ALLOC_INDEXED, fileName, fileSize, contents);
+    }
+    s->output.verbose = verbose;
+    s->compress = compress;
+    free(contents);
+    *fe = store_lookupFile(s, fileName);
+    if (status != STATUS_OK)
+    {
+        store_log(s, "Not enough space to unpack file%d\n", fileName);
+        return status;
+    }
+    s->unpackedFiles++;
+    store_log(s, "Unpacked file%d to grow it\n", fileName);
+    return STATUS_OK;
+}
+
+int store_append(Store *s, int fileName, int count, const int *contents)
+{
+    FileEntry *fe = store_lookupFile(s, fileName);
+    if (fe == NULL)
+    {
+        store_log(s, "File%d not found\n", fileName);
+        return STATUS_NOT_FOUND;
+    }
+    if (fe->allocationType == ALLOC_LINKEDCONTIG && !linkedcontig_canHold(contents, count))
+    {
+        store_log(s, "File%d cannot take values below -1\n", fileName);
+        return STATUS_NO_SPACE;
+    }
+    int status = store_unpackFile(s, &fe);
+    if (status == STATUS_OK)
+    {
+        status = store_preserveFile(s, fe);
+    }
+    if (status == STATUS_OK && count > 0)
+    {
+        status = store_dedupUnshare(s, fe);
+    }
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    BlockNo from = fe->fileSize;
+    status = store_reserve(s, fe, from + count);
+    if (status != STATUS_OK || count == 0)
+    {
+        return status;
+    }
+
+    int blockSize = s->vcb->blockSize;
+    store_log(s, "Appending to file%d at", fileName);
+    if (fe->allocationType == ALLOC_CONTIGUOUS || fe->allocationType == ALLOC_BUDDY)
+    {
+        for (int i = 0; i < count; i++)
+        {
+            BlockNo block = fe->params[0] + (from + i) / blockSize;
+            store_getBlockForWrite(s, block).entries[(from + i) % blockSize] = contents[i];
+            store_indexEntry(s, contents[i], block, fileName);
+            store_log(s, " B%lld(%d)", block, contents[i]);
+        }
+    }
+    else if (fe->allocationType == ALLOC_INDEXED)
+    {
+        Block indexBlock = store_getBlock(s, fe->params[0]);
+        int reads = 0;
+        for (int i = 0; i < count; i++)
+        {
+            BlockNo block = *indexed_slot(s, indexBlock, fe->params[1], (from + i) / blockSize, 0, &reads);
+            store_getBlockForWrite(s, block).entries[(from + i) % blockSize] = contents[i];
+            store_indexEntry(s, contents[i], block, fileName);
+            store_log(s, " B%lld(%d)", block, contents[i]);
+        }
+    }
+    else
+    {
+        // walk to the block holding the end of the file, then fill on from there
+        BlockNo block = fe->params[0];
+        BlockNo blockOffset = 0;
+        BlockNo next;
+        int capacity = chain_capacity(s, fe, block, &next);
+        for (int i = 0; i < count; i++)
+        {
+            while (from + i >= blockOffset + capacity)
+            {
+                blockOffset += capacity;
+                block = next;
+                capacity = chain_capacity(s, fe, block, &next);
+            }
+            store_getBlockForWrite(s, block).entries[from + i - blockOffset] = contents[i];
+            store_indexEntry(s, contents[i], block, fileName);
+            store_log(s, " B%lld(%d)", block, contents[i]);
+        }
+    }
+    store_log(s, "\n");
+    if (s->dedup != NULL && fe->allocationType == ALLOC_INDEXED)
+    {
+        store_dedupAppended(s, fe, from / blockSize, (from + count - 1) / blockSize);
+    }
+    fe->fileSize = from + count;
+    journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+    return STATUS_OK;
+}
+
+// reserves blocks for length entries of a file ahead of its growth, its size stays as it is
+int store_fallocate(Store *s, int fileName, BlockNo length)
+{
+    FileEntry *fe = store_lookupFile(s, fileName);
+    if (fe == NULL)
+    {
+        store_log(s, "File%d not found\n", fileName);
+        return STATUS_NOT_FOUND;
+    }
+    int status = store_unpackFile(s, &fe);
+    if (status == STATUS_OK)
+    {
+        status = store_preserveFile(s, fe);
+    }
+    if (status != STATUS_OK)
+    {
+        return status;
+    }
+    status = store_reserve(s, fe, length);
+    if (status == STATUS_OK)
+    {
+        store_log(s, "File%d has room for %lld entries\n", fileName, length > fe->fileSize ? length : fe->fileSize);
+    }
+    return status;
+}
+
+Snapshot *store_findSnapshot(Store *s, int id)
+{
+    Snapshot *snap = s->vcb->snapshots != NULL ? s->vcb->snapshots->newest : NULL;
+    while (snap != NULL && snap->id != id)
+    {
+        snap = snap->older;
+    }
+    return snap;
+}
+
+// takes snapshot id of the volume, copying the directory but none of the blocks, which it shares with the live volume
+// the first snapshot sets up the per block generations and reference counts
+int store_snapshot(Store *s, int id)
+{
+    if (store_findSnapshot(s, id) != NULL)
+    {
+        store_log(s, "Snapshot %d already exists\n", id);
+        return STATUS_EXISTS;
+    }
+    SnapshotSet *set = s->vcb->snapshots;
+    if (set == NULL)
+    {
+        set = malloc(sizeof(SnapshotSet));
+        set->newest = NULL;
+        set->generation = 0;
+        set->blockGeneration = calloc(s->numBlocks, sizeof(long long));
+        set->refs = calloc(s->numBlocks, sizeof(int));
+        set->copies = 0;
+        set->kept = 0;
+        set->lost = 0;
+        s->vcb->snapshots = set;
+    }
+    Snapshot *snap = malloc(sizeof(Snapshot));
+    snap->id = id;
+    snap->generation = ++set->generation;
+    snap->fileEntry = malloc(sizeof(FileEntry) * s->fileEntrySize);
+    memcpy(snap->fileEntry, s->fileEntry, sizeof(FileEntry) * s->fileEntrySize);
+    snap->dirTable = malloc(sizeof(int) * (s->dirTableMask + 1));
+    memcpy(snap->dirTable, s->dirTable, sizeof(int) * (s->dirTableMask + 1));
+    snap->fat = NULL;
+    if (s->fat != NULL)
+    {
+        snap->fat = malloc(sizeof(int) * s->numBlocks);
+        memcpy(snap->fat, s->fat, sizeof(int) * s->numBlocks);
+    }
+    snap->mapMask = 15;
+    snap->mapCount = 0;
+    snap->mapFrom = malloc(sizeof(BlockNo) * 16);
+    snap->mapTo = malloc(sizeof(BlockNo) * 16);
+    memset(snap->mapFrom, 0xff, sizeof(BlockNo) * 16);
+    snap->older = set->newest;
+    set->newest = snap;
+    store_log(s, "Took snapshot %d\n", id);
+    return STATUS_OK;
+}
+
+// drops snapshot id, the blocks only it held are cleared and freed
+int store_deleteSnapshot(Store *s, int id)
+{
+    Snapshot *snap = store_findSnapshot(s, id);
+    if (snap == NULL)
+    {
+        store_log(s, "Snapshot %d not found\n", id);
+        return STATUS_NOT_FOUND;
+    }
+    SnapshotSet *set = s->vcb->snapshots;
+    Snapshot **link = &set->newest;
+    while (*link != snap)
+    {
+        link = &(*link)->older;
+    }
+    *link = snap->older;
+
+    BlockNo freed = 0;
+    for (BlockNo i = 0; i <= snap->mapMask; i++)
+    {
+        BlockNo to = snap->mapTo[i];
+        if (snap->mapFrom[i] == -1 || --set->refs[to] > 0)
+        {
+            continue;
+        }
+        // the live volume has not used the block since, so nothing else sees it
+        set->blockGeneration[to] = set->generation;
+        Block b = store_getBlockToFree(s, to);
+        vcb_freeBlock(s->vcb, &b);
+        if (s->buddy != NULL)
+        {
+            buddy_release(s->buddy, to, 1);
+        }
+        freed++;
+    }
+    store_log(s, "Deleted snapshot %d and freed %lld blocks\n", id, freed);
+    free(snap->fileEntry);
+    free(snap->dirTable);
+    free(snap->fat);
+    free(snap->mapFrom);
+    free(snap->mapTo);
+    free(snap);
+    return STATUS_OK;
+}
+
+// copies entries of a file as snapshot id saw it, returns -1 when there is no such snapshot or file
+long long store_read_snapshot(Store *s, int id, int fileName, long long offset, long long length, int *out)
+{
+    Snapshot *snap = store_findSnapshot(s, id);
+    if (snap == NULL)
+    {
+        return -1;
+    }
+    // a quiet store over the snapshot's directory, its block views go through the snapshot's map
+    Store view;
+    memset(&view, 0, sizeof(Store));
+    view.vcb = s->vcb;
+    view.fileEntry = snap->fileEntry;
+    view.fileEntrySize = s->fileEntrySize;
+    view.dirTable = snap->dirTable;
+    view.dirTableMask = s->dirTableMask;
+    view.data = s->data;
+    view.numBlocks = s->numBlocks;
+    view.fat = snap->fat;
+    view.view = snap;
+    long long copied = store_read_range(&view, fileName, offset, length, out);
+    s->reads += view.reads;
+    return copied;
+}
+
+// deletes every snapshot, before the volume goes away
+void store_dropSnapshots(Store *s)
+{
+    SnapshotSet *set = s->vcb->snapshots;
+    if (set == NULL)
+    {
+        return;
+    }
+    s->output.verbose = 0;
+    while (set->newest != NULL)
+    {
+        store_deleteSnapshot(s, set->newest->id);
+    }
+    free(set->blockGeneration);
+    free(set->refs);
+    free(set);
+    s->vcb->snapshots = NULL;
+}
+
+// first used block at or after from, or numBlocks when the rest of the volume is free
+static BlockNo freeMap_nextUsed(const VolumeControlBlock *vcb, BlockNo from)
+{
+    BlockNo word = from / FREEMAP_WORD_BITS;
+    if (word >= vcb->freeMapWords)
+    {
+        return vcb->numBlocks;
+    }
+    uint64_t used = ~vcb->freeMap[word] & ~((1ULL << (from % FREEMAP_WORD_BITS)) - 1);
+    while (used == 0 && ++word < vcb->freeMapWords)
+    {
+        used = ~vcb->freeMap[word];
+    }
+    if (used == 0)
+    {
+        return vcb->numBlocks;
+    }
+    BlockNo block = word * FREEMAP_WORD_BITS + __builtin_ctzll(used);
+    return block < vcb->numBlocks ? block : vcb->numBlocks;
+}
+
+// block after block in a linked contiguous chain, -1 at the end, without touching the cache
+static BlockNo linkedcontig_next(Store *s, FileEntry *fe, BlockNo block)
+{
+    int last = store_blockView(s, block).entries[s->vcb->blockSize - 1];
+    if (block == fe->params[1])
+    {
+        return -1;
+    }
+    return linkedcontig_isPointer(last) ? linkedcontig_target(last) : block + 1;
+}
+
+// marks the blocks of a contiguous or linked contiguous file as its own (sign 1) or as no one's (sign -1)
+static void defrag_noteOwner(Store *s, FileEntry *fe, int sign)
+{
+    int owner = sign > 0 ? (int)(fe - s->fileEntry) : -1;
+    if (fe->allocationType == ALLOC_CONTIGUOUS && fe->params[0] >= 0)
+    {
+        for (BlockNo b = fe->params[0]; b < fe->params[0] + fe->params[1]; b++)
+        {
+            s->blockOwners[b] = owner;
+        }
+    }
+    else if (fe->allocationType == ALLOC_LINKEDCONTIG && fe->params[0] >= 0)
+    {
+        for (BlockNo b = fe->params[0]; b != -1; b = linkedcontig_next(s, fe, b))
+        {
+            s->blockOwners[b] = owner;
+        }
+    }
+}
+
+// the file holding block, NULL when it is not a contiguous or linked contiguous file
+// every file is walked once to fill blockOwners, metrics_countFile keeps it up to date after that
+static FileEntry *defrag_owner(Store *s, BlockNo block)
+{
+    if (s->blockOwners == NULL)
+    {
+        s->blockOwners = malloc(sizeof(int) * s->numBlocks);
+        for (BlockNo b = 0; b < s->numBlocks; b++)
+        {
+            s->blockOwners[b] = -1;
+        }
+        for (int i = 0; i < s->fileEntrySize; i++)
+        {
+            if (s->fileEntry[i].fileName != 0)
+            {
+                defrag_noteOwner(s, s->fileEntry + i, 1);
             }
         }
-        else if (allocationType == ALLOC_LINKED)
+    }
+    return s->blockOwners[block] == -1 ? NULL : s->fileEntry + s->blockOwners[block];
+}
+
+// slides a contiguous file down to start at target, [target, params[0]) must be free
+static BlockNo defrag_moveContiguous(Store *s, FileEntry *fe, BlockNo target)
+{
+    int blockSize = s->vcb->blockSize;
+    BlockNo from = fe->params[0];
+    BlockNo count = fe->params[1];
+    for (BlockNo i = 0; i < count; i++)
+    {
+        store_unindexBlock(s, store_getBlock(s, from + i), fe->fileName);
+    }
+    memmove(s->data + (size_t)target * blockSize, s->data + (size_t)from * blockSize, sizeof(int) * blockSize * count);
+    vcb_freeRange(s->vcb, from, count);
+    vcb_useRange(s->vcb, target, count);
+    // the old blocks the file no longer covers are free and cleared
+    for (BlockNo i = target + count > from ? target + count : from; i < from + count; i++)
+    {
+        Block b = store_blockView(s, i);
+        block_clear(&b, blockSize);
+        journal_note(s->vcb->journal, JOURNAL_BLOCK, i);
+    }
+    for (BlockNo i = 0; i < count; i++)
+    {
+        Block b = store_getBlockForWrite(s, target + i);
+        for (int j = 0; j < blockSize; j++)
         {
-            // Get File Entry if none available, End
-            FileEntry *fe = store_findFreeFileEntry(s);
-            if (fe == NULL)
+            if (b.entries[j] != -1)
+            {
+                store_indexEntry(s, b.entries[j], b.index, fe->fileName);
+            }
+        }
+    }
+    fe->params[0] = target;
+    journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+    store_log(s, "Moved file%d from B%lld to B%lld\n", fe->fileName, from, target);
+    return count;
+}
+
+// lays a linked contiguous file out again over the lowest free blocks
+static BlockNo defrag_moveLinkedContig(Store *s, FileEntry *fe)
+{
+    int blockSize = s->vcb->blockSize;
+    int fileName = fe->fileName;
+    BlockNo fileSize = fe->fileSize;
+    int *contents = malloc(sizeof(int) * (fileSize + 1));
+    store_read_range(s, fileName, 0, fileSize, contents);
+    BlockNo from = fe->params[0];
+    BlockNo moved = 0;
+    BlockNo block = from;
+    while (block != -1)
+    {
+        BlockNo next = linkedcontig_next(s, fe, block);
+        Block b = store_getBlock(s, block);
+        store_unindexBlock(s, b, fileName);
+        vcb_freeBlock(s->vcb, &b);
+        moved++;
+        block = next;
+    }
+
+    // take free blocks upwards, a block that is not followed by its neighbour gives an entry to the pointer
+    // scattered free blocks can take more blocks than the file had, but the scan always ends with room:
+    // the freed blocks alone hold the file, taken upwards they need the fewest pointers, and every other block adds room
+    BlockNo blocksCapacity = moved;
+    BlockNo *blocks = malloc(sizeof(BlockNo) * blocksCapacity);
+    BlockNo count = 0;
+    BlockNo capacity = 0;
+    for (BlockNo b = vcb_lowestFree(s->vcb); b < s->numBlocks && (count == 0 || capacity < fileSize); b++)
+    {
+        if (!vcb_isFree(s->vcb, b))
+        {
+            continue;
+        }
+        if (count > 0 && blocks[count - 1] + 1 != b)
+        {
+            capacity--;
+        }
+        if (count == blocksCapacity)
+        {
+            blocksCapacity *= 2;
+            blocks = realloc(blocks, sizeof(BlockNo) * blocksCapacity);
+        }
+        blocks[count++] = b;
+        capacity += blockSize;
+    }
+
+    BlockNo filePos = 0;
+    for (BlockNo i = 0; i < count; i++)
+    {
+        vcb_useBlock(s->vcb, blocks[i]);
+        Block b = store_getBlockForWrite(s, blocks[i]);
+        int pointer = i + 1 < count && blocks[i + 1] != blocks[i] + 1;
+        for (int j = 0; j < blockSize - pointer && filePos < fileSize; j++)
+        {
+            b.entries[j] = contents[filePos];
+            store_indexEntry(s, contents[filePos], b.index, fileName);
+            filePos++;
+        }
+        if (pointer)
+        {
+            b.entries[blockSize - 1] = linkedcontig_pointer(blocks[i + 1]);
+        }
+    }
+    fe->params[0] = blocks[0];
+    fe->params[1] = blocks[count - 1];
+    journal_note(s->vcb->journal, JOURNAL_FILE_ENTRY, fe - s->fileEntry);
+    store_dropCursor(s, fileName);
+    store_log(s, "Moved file%d from B%lld to B%lld\n", fileName, from, blocks[0]);
+    free(blocks);
+    free(contents);
+    return count;
+}
+
+// content blocks below an index or indirect block in file order, counting runs of adjacent blocks
+static void metrics_walkIndexed(Store *s, BlockNo block, int depth, BlockNo *last, long long *extents)
+{
+    int *entries = store_blockView(s, block).entries;
+    for (int i = 0; i < s->vcb->blockSize && entries[i] != -1; i++)
+    {
+        if (depth > 0)
+        {
+            metrics_walkIndexed(s, entries[i], depth - 1, last, extents);
+            continue;
+        }
+        if (entries[i] != *last + 1)
+        {
+            (*extents)++;
+        }
+        *last = entries[i];
+    }
+}
+
+// adds (sign 1) or takes away (sign -1) what a file contributes to the volume metrics
+// the layout is read without going through the cache, as an allocator would keep it in memory
+void metrics_countFile(Store *s, FileEntry *fe, int sign)
+{
+    int blockSize = s->vcb->blockSize;
+    if (s->blockOwners != NULL)
+    {
+        defrag_noteOwner(s, fe, sign);
+    }
+    BlockNo blocks = 0;
+    long long extents = 0;
+    long long pointers = 0;
+    if (fe->allocationType == ALLOC_CONTIGUOUS || fe->allocationType == ALLOC_BUDDY)
+    {
+        blocks = fe->params[1];
+        extents = 1;
+    }
+    else if (fe->allocationType == ALLOC_INDEXED)
+    {
+        BlockNo contentBlocks = fe->params[1];
+        int direct = contentBlocks <= blockSize ? blockSize : blockSize - indexed_indirectSlots(blockSize);
+        int *index = store_blockView(s, fe->params[0]).entries;
+        BlockNo last = -2;
+        for (int y = 0; y < blockSize && index[y] != -1; y++)
+        {
+            if (y < direct)
             {
-                printf("No File Entry available\n");
+                extents += index[y] != last + 1;
+                last = index[y];
             }
             else
             {
-                // Get Number of blocks needed
-                int blockSize = s->vcb->blockSize;
-                int blocksNeeded = 0;
-                int entriesLeft = fileSize;
-                while (entriesLeft > blockSize)
-                {
-                    entriesLeft -= (blockSize - 1);
-                    blocksNeeded++;
-                }
-                blocksNeeded++;
+                metrics_walkIndexed(s, index[y], y - direct, &last, &extents);
+            }
+        }
+        blocks = contentBlocks;
+        // index and indirect blocks hold nothing but pointers
+        pointers = indexed_metaBlocks(blockSize, contentBlocks) * blockSize;
+    }
+    else if (fe->params[0] >= 0)
+    {
+        // linked and linked contiguous chains, a pointer in a block or a FAT entry links each block to the next
+        extents = 1;
+        for (BlockNo b = fe->params[0]; b != fe->params[1] && b >= 0 && b < s->numBlocks; blocks++)
+        {
+            BlockNo next;
+            if (fe->allocationType == ALLOC_LINKEDCONTIG)
+            {
+                next = linkedcontig_next(s, fe, b);
+                pointers += next != b + 1;
+            }
+            else
+            {
+                next = s->fat != NULL ? s->fat[b] : store_blockView(s, b).entries[blockSize - 1];
+                pointers += s->fat == NULL;
+            }
+            extents += next != b + 1;
+            b = next;
+        }
+        blocks++;
+    }
+    VolumeMetrics *m = &s->metrics;
+    m->files += sign;
+    m->fileExtents += sign * extents;
+    // a packed indexed file counts its slack in the entries its blocks could still take
+    int perBlock = fe->allocationType == ALLOC_INDEXED ? indexed_perBlock(blockSize, fe) : blockSize;
+    m->slack += sign * (blocks * perBlock - (fe->allocationType == ALLOC_INDEXED ? 0 : pointers) - fe->fileSize);
+    m->pointerEntries += sign * pointers;
+}
+
+// recounts the metrics of every file, after mounting an image
+void metrics_recount(Store *s)
+{
+    memset(&s->metrics, 0, sizeof(VolumeMetrics));
+    for (int i = 0; i < s->fileEntrySize; i++)
+    {
+        if (s->fileEntry[i].fileName != 0)
+        {
+            metrics_countFile(s, s->fileEntry + i, 1);
+        }
+    }
+}
+
+// one line with the free space and file layout metrics
+void store_printMetrics(Store *s, FILE *text, const char *label)
+{
+    ExtentTree *extents = &s->vcb->extents;
+    VolumeMetrics *m = &s->metrics;
+    fprintf(text, "%s: %d free extents, largest %lld, by length", label, extents->count,
+            extents->byStart == -1 ? 0 : extents->nodes[extents->byStart].maxLength);
+    for (int b = 0; b < EXTENT_BUCKETS; b++)
+    {
+        if (extents->lengthCounts[b] > 0 && b == 0)
+        {
+            fprintf(text, " 1:%d", extents->lengthCounts[b]);
+        }
+        else if (extents->lengthCounts[b] > 0)
+        {
+            fprintf(text, " %lld-%lld:%d", 1LL << b, (1LL << b) * 2 - 1, extents->lengthCounts[b]);
+        }
+    }
+    fprintf(text, ", %lld files, %.2f extents/file, %lld slack entries, %lld pointer entries\n", m->files,
+            m->files > 0 ? (double)m->fileExtents / m->files : 0.0, m->slack, m->pointerEntries);
+}
+
+// moves whole files down into the lowest hole until maxMoves blocks have moved
+// returns the blocks moved, 0 once the used blocks are packed or the next one cannot be moved
+BlockNo store_defragStep(Store *s, BlockNo maxMoves)
+{
+    VolumeControlBlock *vcb = s->vcb;
+    BlockNo moves = 0;
+    // moving blocks would leave the snapshots that share them behind
+    if (vcb->snapshots != NULL && vcb->snapshots->newest != NULL)
+    {
+        return 0;
+    }
+    while (moves < maxMoves)
+    {
+        BlockNo hole = vcb_lowestFree(vcb);
+        if (hole == -1)
+        {
+            break;
+        }
+        BlockNo used = freeMap_nextUsed(vcb, hole);
+        if (used == vcb->numBlocks)
+        {
+            break;
+        }
+        FileEntry *fe = defrag_owner(s, used);
+        if (fe == NULL)
+        {
+            break;
+        }
+        metrics_countFile(s, fe, -1);
+        moves += fe->allocationType == ALLOC_CONTIGUOUS ? defrag_moveContiguous(s, fe, hole) : defrag_moveLinkedContig(s, fe);
+        metrics_countFile(s, fe, 1);
+        s->defragFiles++;
+    }
+    s->defragMoves += moves;
+    return moves;
+}
+
+// runs defragmentation steps next to the replay, which holds lock around each instruction
+typedef struct defragmenter
+{
+    Store *store;
+    BlockNo stepMoves;
+    pthread_mutex_t lock;
+    pthread_t thread;
+    int stop;
+} Defragmenter;
+
+static void *defrag_worker(void *arg)
+{
+    Defragmenter *d = arg;
+    while (1)
+    {
+        pthread_mutex_lock(&d->lock);
+        if (d->stop)
+        {
+            pthread_mutex_unlock(&d->lock);
+            break;
+        }
+        BlockNo moved = store_defragStep(d->store, d->stepMoves);
+        pthread_mutex_unlock(&d->lock);
+        if (moved == 0)
+        {
+            // packed for now, wait for the replay to make new holes
+            struct timespec pause = {0, 200000};
+            nanosleep(&pause, NULL);
+        }
+    }
+    return NULL;
+}
+
+void defrag_start(Defragmenter *d, Store *s, BlockNo stepMoves)
+{
+    d->store = s;
+    d->stepMoves = stepMoves;
+    d->stop = 0;
+    pthread_mutex_init(&d->lock, NULL);
+    pthread_create(&d->thread, NULL, defrag_worker, d);
+}
+
+void defrag_stop(Defragmenter *d)
+{
+    pthread_mutex_lock(&d->lock);
+    d->stop = 1;
+    pthread_mutex_unlock(&d->lock);
+    pthread_join(d->thread, NULL);
+    pthread_mutex_destroy(&d->lock);
+}
+
+const char *actionName(int action)
+{
+    if (action == ACTION_ADD)
+    {
+        return "add";
+    }
+    if (action == ACTION_READ)
+    {
+        return "read";
+    }
+    if (action == ACTION_RANGE)
+    {
+        return "range";
+    }
+    if (action == ACTION_APPEND)
+    {
+        return "append";
+    }
+    if (action == ACTION_FALLOCATE)
+    {
+        return "fallocate";
+    }
+    if (action == ACTION_SNAPSHOT)
+    {
+        return "snapshot";
+    }
+    if (action == ACTION_SNAPRANGE)
+    {
+        return "snaprange";
+    }
+    if (action == ACTION_SNAPDELETE)
+    {
+        return "snapdelete";
+    }
+    return "delete";
+}
+
+static int parseAction(const char *text, size_t length)
+{
+    if (length == 3 && memcmp(text, "add", 3) == 0)
+    {
+        return ACTION_ADD;
+    }
+    if (length == 4 && memcmp(text, "read", 4) == 0)
+    {
+        return ACTION_READ;
+    }
+    if (length == 6 && memcmp(text, "delete", 6) == 0)
+    {
+        return ACTION_DELETE;
+    }
+    if (length == 5 && memcmp(text, "range", 5) == 0)
+    {
+        return ACTION_RANGE;
+    }
+    if (length == 6 && memcmp(text, "append", 6) == 0)
+    {
+        return ACTION_APPEND;
+    }
+    if (length == 9 && memcmp(text, "fallocate", 9) == 0)
+    {
+        return ACTION_FALLOCATE;
+    }
+    if (length == 8 && memcmp(text, "snapshot", 8) == 0)
+    {
+        return ACTION_SNAPSHOT;
+    }
+    if (length == 9 && memcmp(text, "snaprange", 9) == 0)
+    {
+        return ACTION_SNAPRANGE;
+    }
+    if (length == 10 && memcmp(text, "snapdelete", 10) == 0)
+    {
+        return ACTION_SNAPDELETE;
+    }
+    return 0;
+}
+
+// parse an integer field at *p, leaves *p on the character after it
+static int parseInt(const char **p, const char *end)
+{
+    const char *c = *p;
+    int negative = 0;
+    long long value = 0;
+    while (c < end && (*c == ' ' || *c == '\t'))
+    {
+        c++;
+    }
+    if (c < end && (*c == '-' || *c == '+'))
+    {
+        negative = *c == '-';
+        c++;
+    }
+    while (c < end && *c >= '0' && *c <= '9')
+    {
+        value = value * 10 + (*c - '0');
+        c++;
+    }
+    while (c < end && *c != ',')
+    {
+        c++;
+    }
+    *p = c;
+    return (int)(negative ? -value : value);
+}
+
+void instructions_init(InstructionList *list)
+{
+    list->capacity = 64;
+    list->count = 0;
+    list->items = malloc(sizeof(Instruction) * list->capacity);
+    list->contentCapacity = 256;
+    list->contentCount = 0;
+    list->contents = malloc(sizeof(int) * list->contentCapacity);
+}
+
+Instruction *instructions_push(InstructionList *list, int action, int fileName)
+{
+    if (list->count == list->capacity)
+    {
+        list->capacity *= 2;
+        list->items = realloc(list->items, sizeof(Instruction) * list->capacity);
+    }
+    Instruction *instruction = list->items + list->count++;
+    instruction->action = action;
+    instruction->fileName = fileName;
+    instruction->fileSize = 0;
+    // the arena may still move, so remember the offset until the list is finished
+    instruction->fileContent = (int *)(uintptr_t)list->contentCount;
+    return instruction;
+}
+
+void instructions_pushContent(InstructionList *list, Instruction *instruction, int value)
+{
+    if (list->contentCount == list->contentCapacity)
+    {
+        list->contentCapacity *= 2;
+        list->contents = realloc(list->contents, sizeof(int) * list->contentCapacity);
+    }
+    list->contents[list->contentCount++] = value;
+    instruction->fileSize++;
+}
+
+// turn content offsets into pointers once nothing more is pushed
+void instructions_finish(InstructionList *list)
+{
+    for (size_t i = 0; i < list->count; i++)
+    {
+        list->items[i].fileContent = list->contents + (uintptr_t)list->items[i].fileContent;
+    }
+}
+
+// tokenize one line in place, lines with an unknown action are skipped
+static void parseLine(InstructionList *list, const char *line, const char *end)
+{
+    while (end > line && (end[-1] == '\r' || end[-1] == ' '))
+    {
+        end--;
+    }
+    const char *comma = memchr(line, ',', end - line);
+    if (comma == NULL)
+    {
+        return;
+    }
+    int action = parseAction(line, comma - line);
+    if (action == 0)
+    {
+        return;
+    }
+
+    const char *p = comma + 1;
+    Instruction *instruction = instructions_push(list, action, parseInt(&p, end));
+    while (p < end)
+    {
+        p++;
+        instructions_pushContent(list, instruction, parseInt(&p, end));
+    }
+    // values below -1 are kept for linked contiguous chain pointers, so a line holding one is dropped
+    if ((action == ACTION_ADD || action == ACTION_APPEND) &&
+        !linkedcontig_canHold(list->contents + list->contentCount - instruction->fileSize, instruction->fileSize))
+    {
+        list->contentCount -= instruction->fileSize;
+        list->count--;
+    }
+}
 
-                // If there is not enoguh space, End. Else start file allocation
-                if (blocksNeeded > s->vcb->freeBlockNum)
-                {
-                    printf("Not enough space for file\n");
-                }
-                else
-                {
-                    Block **blocks = malloc(sizeof(Block *) * blocksNeeded);
-                    //find free block(s)
-                    for (int i = 0; i < blocksNeeded; i++)
-                    {
-                        blocks[i] = store_findFreeBlock(s);
-                        vcb_useBlock(s->vcb, blocks[i]->index);
-                    }
-                    printf("Adding File%d, found blocks: ", fileName);
-                    for (int i = 0; i < blocksNeeded; i++)
-                    {
-                        printf("B%d ", blocks[i]->index);
-                    }
-                    printf("\n");
-                    //set file entry to values
-                    fe->fileName = fileName;
-                    fe->params[0] = blocks[0]->index;
-                    fe->params[1] = blocks[blocksNeeded - 1]->index;
+// stream the instruction file a chunk at a time, returns 0 when it cannot be read
+int readInstructions(const char *path, InstructionList *list)
+{
+    FILE *f = fopen(path, "rb");
+    if (f == NULL)
+    {
+        return 0;
+    }
+    instructions_init(list);
 
-                    //allocate the file content to the blocks
-                    printf("Added File%d at: ", fileName);
-                    int filePos = 0;
-                    for (int i = 0; i < blocksNeeded; i++)
-                    {
-                        printf("B%d(", blocks[i]->index);
-                        int count = 0;
-                        //Fill upto blocksize - 1 or if fileSize - 1
-                        while (count < blockSize - 1 && filePos < fileSize - 1)
-                        {
-                            blocks[i]->entries[count] = fileContents[filePos];
-                            printf("%d ", fileContents[filePos]);
-                            count++;
-                            filePos++;
-                        }
-                        //if there is leftover point to the next block. else fill the slot with file entry
-                        if (i < blocksNeeded - 1)
-                        {
-                            blocks[i]->entries[count] = blocks[i + 1]->index;
-                            printf("), ");
-                        }
-                        else if (filePos < fileSize)
-                        {
-                            blocks[i]->entries[count] = fileContents[filePos];
-                            printf("%d)\n", fileContents[filePos]);
-                        }
-                        else if (fileSize == 0)
-                        {
-                            printf(")\n");
-                        }
-                    }
-                    free(blocks);
-                }
-            }
+    size_t bufferSize = CSV_CHUNK;
+    char *buffer = malloc(bufferSize);
+    // bytes of an unfinished line kept at the front of the buffer
+    size_t pending = 0;
+    while (1)
+    {
+        if (pending == bufferSize)
+        {
+            // a single line longer than the buffer
+            bufferSize *= 2;
+            buffer = realloc(buffer, bufferSize);
         }
-        else if (allocationType == ALLOC_INDEXED)
+        size_t got = fread(buffer + pending, 1, bufferSize - pending, f);
+        size_t filled = pending + got;
+        char *line = buffer;
+        char *newline;
+        while ((newline = memchr(line, '\n', buffer + filled - line)) != NULL)
         {
-            // minimum 1 for block containing the indices
-            int blocksRequired = 1;
-            // round up the filesize / blocksize
-            // because any remainder means extra block is needed
-            blocksRequired += ceil(fileSize / (double)s->vcb->blockSize);
-            int entriesSupported = s->vcb->blockSize * s->vcb->blockSize;
-
-            // when fileSize is more than entries supported by blockSize
-            // or when blocksRequired is more than numbers of free block
-            if (fileSize > entriesSupported || blocksRequired > s->vcb->freeBlockNum)
-            {
-                printf("Not enough space\n");
-                return;
-            }
-            //For Printing
-            char out[320];
-            char added[1000];
-            char blockIndex[7];
-            char entryIndex[7];
-            sprintf(out, "Adding file%d and found free ", fileName);
-            sprintf(added, "Added file%d at ", fileName);
-
-            Block *indexBlock = store_findFreeBlock(s);
-            sprintf(blockIndex, "B%d, ", indexBlock->index);
-            strcat(out, blockIndex);
-            vcb_useBlock(s->vcb, indexBlock->index);
-            FileEntry *entry = store_findFreeFileEntry(s);
-            entry->fileName = fileName;
-            entry->params[0] = indexBlock->index;
+            parseLine(list, line, newline);
+            line = newline + 1;
+        }
+        pending = buffer + filled - line;
+        if (got == 0)
+        {
+            // last line without a trailing newline
+            parseLine(list, line, line + pending);
+            break;
+        }
+        memmove(buffer, line, pending);
+    }
+    free(buffer);
+    fclose(f);
+    instructions_finish(list);
+    return 1;
+}
 
-            blocksRequired--;
-            for (int i = 0; i < blocksRequired; i++)
-            {
-                // find the next free block
-                Block *contentBlock = store_findFreeBlock(s);
-                //Printing
-                sprintf(blockIndex, "B%d, ", contentBlock->index);
-                strcat(out, blockIndex);
-                sprintf(blockIndex, "B%d(", contentBlock->index);
-                strcat(added, blockIndex);
-                vcb_useBlock(s->vcb, contentBlock->index);
-                // update the content block
-                int offset = s->vcb->blockSize * i;
-                for (int y = 0; y < s->vcb->blockSize && y + offset < fileSize; y++)
-                {
-                    contentBlock->entries[y] = fileContents[y + offset];
-                    sprintf(entryIndex, "%d, ", fileContents[y + offset]);
-                    strcat(added, entryIndex);
-                }
-                int a = strlen(added);
-                added[a - 2] = ')';
-                // update the index block
-                indexBlock->entries[i] = contentBlock->index;
-            }
+void freeInstructions(InstructionList *list)
+{
+    free(list->items);
+    free(list->contents);
+}
 
-            int n = strlen(out);
-            out[n - 2] = '\0';
-            printf("%s\n", out);
-            printf("%s\n", added);
+// replays one instruction against the store and records its outcome
+static int store_dispatch(Store *s, int allocationType, const Instruction *instruction)
+{
+    int status = STATUS_OK;
+    store_log(s, "\naction: %s, fileName: %d \n", actionName(instruction->action), instruction->fileName);
+    if (instruction->action == ACTION_READ)
+    {
+        status = store_read(s, allocationType, instruction->fileName);
+    }
+    else if (instruction->action == ACTION_DELETE)
+    {
+        FileEntry *fe = store_lookupFile(s, instruction->fileName);
+        if (fe != NULL)
+        {
+            metrics_countFile(s, fe, -1);
         }
-        else if (allocationType == ALLOC_LINKEDCONTIG)
+        status = store_delete(s, allocationType, instruction->fileName);
+    }
+    else if (instruction->action == ACTION_ADD)
+    {
+        status = store_add(s, allocationType, instruction->fileName, instruction->fileSize, instruction->fileContent);
+        if (status == STATUS_OK)
         {
-            //get the amount of entries required
-            int blockSize = s->vcb->blockSize;
-            int entriesRequired = fileSize;
-            if (fileSize == 0)
-            {
-                entriesRequired = 1;
-            }
-            int availableBlocks = 0;
-            int prevBlock = 1;
-            //get available file entry
-            FileEntry *fe = store_findFreeFileEntry(s);
-            if (fe == NULL)
-            {
-                printf("No File Entry available\n");
-                return;
-            }
-            //get the number of blocks needed
-            while (blockSize * availableBlocks < entriesRequired)
-            {
-                for (int i = 0; i < s->numBlocks; i++)
-                {
-                    if (s->blocks[i].entries[0] == -1)
-                    {
-                        prevBlock = 0;
-                        availableBlocks++;
-                    }
-                    else
-                    {
-                        if (prevBlock == 0)
-                        {
-                            entriesRequired++;
-                        }
-                        prevBlock = 1;
-                    }
-                    if (blockSize * availableBlocks >= entriesRequired)
-                    {
-                        break;
-                    }
-                }
-                //if not enough break
-                if (blockSize * availableBlocks < entriesRequired)
-                {
-                    printf("Not enough space found\n");
-                    return;
-                }
-            }
-
-            //allocate pointers to store the block
-            Block **blocks = malloc(sizeof(Block *) * availableBlocks);
-            for (int i = 0; i < availableBlocks; i++)
+            metrics_countFile(s, store_lookupFile(s, instruction->fileName), 1);
+        }
+    }
+    else if (instruction->action == ACTION_RANGE || instruction->action == ACTION_SNAPRANGE)
+    {
+        // range,fileName,offset,length or snaprange,snapshot,fileName,offset,length
+        int snapshot = instruction->action == ACTION_SNAPRANGE;
+        int fileName = snapshot ? (instruction->fileSize > 0 ? instruction->fileContent[0] : 0) : instruction->fileName;
+        const int *fields = instruction->fileContent + snapshot;
+        int fieldCount = instruction->fileSize - snapshot;
+        long long offset = fieldCount > 0 ? fields[0] : 0;
+        long long length = fieldCount > 1 ? fields[1] : 1;
+        int *out = malloc(sizeof(int) * (length > 0 ? length : 1));
+        long long copied = snapshot ? store_read_snapshot(s, instruction->fileName, fileName, offset, length, out)
+                                    : store_read_range(s, fileName, offset, length, out);
+        if (copied == -1)
+        {
+            if (snapshot)
             {
-                blocks[i] = store_findFreeBlock(s);
-                vcb_useBlock(s->vcb, blocks[i]->index);
+                store_log(s, "File%d not found in snapshot %d\n", fileName, instruction->fileName);
             }
-            printf("Adding File%d, found blocks: ", fileName);
-            for (int i = 0; i < availableBlocks; i++)
+            else
             {
-                printf("B%d ", blocks[i]->index);
+                store_log(s, "File%d not found\n", fileName);
             }
-            printf("\n");
-            //set the file pointer to the blocks needed
-            fe->fileName = fileName;
-            fe->params[0] = blocks[0]->index;
-            fe->params[1] = blocks[availableBlocks - 1]->index;
-            int currBlock = 0;
-            int filePos = 0;
-            printf("Adding to ");
-            //while not the end of file
-            while (filePos < fileSize)
+            status = STATUS_NOT_FOUND;
+        }
+        else
+        {
+            store_log(s, "Read %lld entries of file%d from %lld:", copied, fileName, offset);
+            for (long long i = 0; i < copied; i++)
             {
-                printf("B%d(", blocks[currBlock]->index);
-                int i;
-                //insert to blocksize - 1
-                for (i = 0; i < blockSize - 1 && filePos < fileSize; i++)
-                {
-                    blocks[currBlock]->entries[i] = fileContents[filePos];
-                    printf("%d ", fileContents[filePos]);
-                    filePos++;
-                }
-                //If next block is null means it is the last block
-                if (currBlock < availableBlocks - 1)
-                {
-                    //if nextBlock index not currBlock index+1, it is not contiguous set entry as the pointer to next block else set to content
-                    if (blocks[currBlock + 1]->index != blocks[currBlock]->index + 1)
-                    {
-                        blocks[currBlock]->entries[i] = blocks[currBlock + 1]->index;
-                        printf("%d ", blocks[currBlock + 1]->index);
-                    }
-                    else
-                    {
-                        blocks[currBlock]->entries[i] = fileContents[filePos];
-                        printf("%d ", fileContents[filePos]);
-                        filePos++;
-                    }
-                    printf("), ");
-                    currBlock++;
-                }
-                else if (filePos < fileSize)
-                {
-                    blocks[currBlock]->entries[i] = fileContents[filePos];
-                    printf("%d ", fileContents[filePos]);
-                }
+                store_log(s, " %d", out[i]);
             }
-            printf(")\n");
-            free(blocks);
+            store_log(s, "\n");
+        }
+        free(out);
+    }
+    else if (instruction->action == ACTION_APPEND || instruction->action == ACTION_FALLOCATE)
+    {
+        // append,fileName,values... or fallocate,fileName,length
+        FileEntry *fe = store_lookupFile(s, instruction->fileName);
+        if (fe != NULL)
+        {
+            metrics_countFile(s, fe, -1);
+        }
+        if (instruction->action == ACTION_APPEND)
+        {
+            status = store_append(s, instruction->fileName, instruction->fileSize, instruction->fileContent);
+        }
+        else
+        {
+            status = store_fallocate(s, instruction->fileName, instruction->fileSize > 0 ? instruction->fileContent[0] : 0);
         }
+        // unpacking a file adds it again, so it is looked up afresh
+        fe = fe != NULL ? store_lookupFile(s, instruction->fileName) : NULL;
+        if (fe != NULL)
+        {
+            metrics_countFile(s, fe, 1);
+        }
+    }
+    else if (instruction->action == ACTION_SNAPSHOT)
+    {
+        status = store_snapshot(s, instruction->fileName);
     }
+    else if (instruction->action == ACTION_SNAPDELETE)
+    {
+        status = store_deleteSnapshot(s, instruction->fileName);
+    }
+    store_logEvent(s, allocationType, instruction->action, instruction->fileName, status);
+    if (instruction->action != ACTION_READ && instruction->action != ACTION_RANGE && instruction->action != ACTION_SNAPRANGE)
+    {
+        journal_endOp(s->vcb->journal);
+    }
+    return status;
 }
 
-void store_read(Store *s, int allocationType, int fileName)
+// lets several threads use the volume, its output must be quiet
+void store_enableLocks(Store *s)
 {
-    if (allocationType == ALLOC_CONTIGUOUS)
+    StoreLocks *locks = malloc(sizeof(StoreLocks));
+    for (int i = 0; i < FILE_LOCK_STRIPES; i++)
     {
-        int blockSize = -1;
-        int blockIndex = -1;
-        int reads = 0;
+        pthread_rwlock_init(locks->fileLocks + i, NULL);
+    }
+    pthread_mutex_init(&locks->allocLock, NULL);
+    pthread_rwlock_init(&locks->dirLock, NULL);
+    pthread_mutex_init(&locks->sharedLock, NULL);
+    s->locks = locks;
+}
 
-        //find the block Index and block Size
-        for (int i = 0; i < s->vcb->blockSize; ++i)
+void store_disableLocks(Store *s)
+{
+    StoreLocks *locks = s->locks;
+    if (locks == NULL)
+    {
+        return;
+    }
+    for (int i = 0; i < FILE_LOCK_STRIPES; i++)
+    {
+        pthread_rwlock_destroy(locks->fileLocks + i);
+    }
+    pthread_mutex_destroy(&locks->allocLock);
+    pthread_rwlock_destroy(&locks->dirLock);
+    pthread_mutex_destroy(&locks->sharedLock);
+    free(locks);
+    s->locks = NULL;
+}
+
+// holds adds back and places them threshold at a time, or when another instruction comes
+void store_enableDelayedAdds(Store *s, int threshold)
+{
+    DelayedAdds *d = malloc(sizeof(DelayedAdds));
+    d->threshold = threshold;
+    d->allocationType = 0;
+    d->pending = malloc(sizeof(DelayedAdd) * threshold);
+    d->count = 0;
+    d->contents = NULL;
+    d->contentUsed = 0;
+    d->contentCapacity = 0;
+    memset(d->statusCount, 0, sizeof(d->statusCount));
+    d->batches = 0;
+    d->packedBatches = 0;
+    s->delayed = d;
+}
+
+// largest files first, the order they came in otherwise
+static int delayed_compare(const void *a, const void *b)
+{
+    const DelayedAdd *x = a;
+    const DelayedAdd *y = b;
+    if (x->instruction.fileSize != y->instruction.fileSize)
+    {
+        return x->instruction.fileSize > y->instruction.fileSize ? -1 : 1;
+    }
+    return x->order - y->order;
+}
+
+// places every pending add in one pass, largest first so the big runs are taken before small files split them
+// a full batch of contiguous files is a burst, it reserves one free run for all of them when there is one so they pack
+// back to back; a smaller batch cut short by another instruction is placed file by file to keep filling small holes
+void store_flushDelayed(Store *s)
+{
+    DelayedAdds *d = s->delayed;
+    if (d == NULL || d->count == 0)
+    {
+        return;
+    }
+    qsort(d->pending, d->count, sizeof(DelayedAdd), delayed_compare);
+    int packed = 0;
+    if (d->allocationType == ALLOC_CONTIGUOUS && d->count == d->threshold)
+    {
+        int blockSize = s->vcb->blockSize;
+        BlockNo demand = 0;
+        for (int i = 0; i < d->count; i++)
         {
-            reads++;
-            if (s->fileEntry[i].fileName == fileName)
-            {
-                blockIndex = s->fileEntry[i].params[0];
-                blockSize = s->fileEntry[i].params[1];
-            }
+            int size = d->pending[i].instruction.fileSize;
+            demand += size > 0 ? (size + blockSize - 1) / blockSize : 1;
+        }
+        BlockNo traversals = 0;
+        BlockNo start = demand <= s->vcb->freeBlockNum ? vcb_findFreeRun(s->vcb, demand, &traversals) : -1;
+        s->traversals += traversals;
+        if (start != -1)
+        {
+            s->batchStart = start;
+            s->batchLeft = demand;
+            packed = 1;
+            d->packedBatches++;
         }
+    }
+    store_log(s, "\nPlacing %d delayed adds%s\n", d->count, packed ? " in one free run" : "");
+    for (int i = 0; i < d->count; i++)
+    {
+        Instruction instruction = d->pending[i].instruction;
+        instruction.fileContent = d->contents + d->pending[i].contentAt;
+        d->statusCount[store_dispatch(s, d->allocationType, &instruction)]++;
+    }
+    s->batchLeft = 0;
+    d->count = 0;
+    d->contentUsed = 0;
+    d->batches++;
+}
 
-        // if block size and block index does not exist
-        if (blockSize == -1 && blockIndex == -1)
+// keeps a copy of the add for the next batch, which is placed at once when it is full
+// a second add of a pending name places the batch first, sorting must not change which of them wins
+static void store_delayAdd(Store *s, int allocationType, const Instruction *instruction)
+{
+    DelayedAdds *d = s->delayed;
+    for (int i = 0; i < d->count; i++)
+    {
+        if (d->pending[i].instruction.fileName == instruction->fileName)
         {
-            //loop through the entire program entries
-            for (int i = 0; i < s->numBlocks * s->vcb->blockSize; ++i)
-            {
-                //if entries is fileName
-                if (s->blocks[0].entries[i] == fileName)
-                {
-                    blockIndex = i / s->vcb->blockSize;
-                    if (i % s->vcb->blockSize > 0)
-                    {
-                        blockIndex++;
-                    }
-                    //find the block in range in file entry
-                    for (int j = 0; j < s->fileEntrySize; ++j)
-                    {
-                        reads++;
-                        if (blockIndex >= s->fileEntry[j].params[0] && blockIndex <= s->fileEntry[j].params[0] + s->fileEntry[j].params[1])
-                        {
-                            printf("Read %d(%d) from %d\n", s->fileEntry[j].fileName, fileName, blockIndex - 1);
-                            break;
-                        }
-                    }
-                    break;
-                }
-            }
+            store_flushDelayed(s);
+            break;
+        }
+    }
+    if (d->contentUsed + instruction->fileSize > d->contentCapacity)
+    {
+        d->contentCapacity = (d->contentUsed + instruction->fileSize) * 2;
+        d->contents = realloc(d->contents, sizeof(int) * d->contentCapacity);
+    }
+    DelayedAdd *add = d->pending + d->count;
+    add->instruction = *instruction;
+    add->contentAt = d->contentUsed;
+    add->order = d->count++;
+    if (instruction->fileSize > 0)
+    {
+        memcpy(d->contents + d->contentUsed, instruction->fileContent, sizeof(int) * instruction->fileSize);
+    }
+    d->contentUsed += instruction->fileSize;
+    d->allocationType = allocationType;
+    if (d->count == d->threshold)
+    {
+        store_flushDelayed(s);
+    }
+}
+
+// places what is still pending and goes back to placing adds as they come
+void store_disableDelayedAdds(Store *s)
+{
+    DelayedAdds *d = s->delayed;
+    if (d == NULL)
+    {
+        return;
+    }
+    store_flushDelayed(s);
+    free(d->pending);
+    free(d->contents);
+    free(d);
+    s->delayed = NULL;
+}
+
+// applies one instruction, taking the locks it needs when the volume is shared
+// with delayed allocation an add only joins the pending batch, anything else places the batch first
+int store_apply(Store *s, int allocationType, const Instruction *instruction)
+{
+    if (s->delayed != NULL)
+    {
+        if (instruction->action == ACTION_ADD)
+        {
+            store_delayAdd(s, allocationType, instruction);
+            return STATUS_DELAYED;
         }
-        for (int i = 0; i < blockSize; ++i)
+        store_flushDelayed(s);
+    }
+    StoreLocks *locks = s->locks;
+    if (locks == NULL)
+    {
+        return store_dispatch(s, allocationType, instruction);
+    }
+    int action = instruction->action;
+    int changes = action != ACTION_READ && action != ACTION_RANGE && action != ACTION_SNAPRANGE;
+    pthread_rwlock_t *fileLock = locks->fileLocks + dir_hash(instruction->fileName / 100 * 100) % FILE_LOCK_STRIPES;
+    if (changes)
+    {
+        pthread_rwlock_wrlock(fileLock);
+    }
+    else
+    {
+        pthread_rwlock_rdlock(fileLock);
+    }
+    // contiguous, buddy and indexed reads of something that is not a file name scan the volume or the content index
+    // and a snapshot read must not see blocks being handed over to it
+    int wholeVolume = changes || action == ACTION_SNAPRANGE || (action == ACTION_READ && allocationType != ALLOC_LINKED && allocationType != ALLOC_LINKEDCONTIG &&
+                                  store_lookupFile(s, instruction->fileName) == NULL);
+    if (wholeVolume)
+    {
+        pthread_mutex_lock(&locks->allocLock);
+    }
+    int status = store_dispatch(s, allocationType, instruction);
+    if (wholeVolume)
+    {
+        pthread_mutex_unlock(&locks->allocLock);
+    }
+    pthread_rwlock_unlock(fileLock);
+    return status;
+}
+
+// one allocation type replayed against the shared instruction list
+typedef struct replayJob
+{
+    int allocationType;
+    const char *name;
+    VolumeGeometry geometry;
+    int fitPolicy;
+    int useContentIndex;
+    // indexed files share identical content blocks
+    int useDedup;
+    // indexed files are packed by frame of reference when that saves blocks
+    int compress;
+    int quiet;
+    const InstructionList *list;
+    FILE *text;
+    FILE *events;
+    // volume image to mount or create, NULL for a volume in memory
+    const char *imageName;
+    int mountImage;
+    // linked files keep their chains in a FAT
+    int useFat;
+    // changes per journal commit, 0 for an image without a journal
+    int journalOps;
+    // instructions replayed before the process stops without closing the image, 0 to replay them all
+    size_t crashAfter;
+    // adds placed per batch by delayed allocation, 0 to place each one as it comes
+    int delayThreshold;
+    // frames of the simulated buffer cache, 0 without one
+    int cacheFrames;
+    int cachePolicy;
+    // device the block accesses are timed against, 0 for none
+    int device;
+    // blocks the defragmenter may move per step, 0 without one
+    BlockNo defragMoves;
+    // run the steps on a background thread instead of between instructions
+    int defragThread;
+    // instructions between metrics lines, 0 for none
+    size_t metricsEvery;
+    int failed;
+    int done;
+} ReplayJob;
+
+// workers take the next job until none are left, main waits on finished
+typedef struct replayPool
+{
+    ReplayJob *jobs;
+    int jobCount;
+    int next;
+    pthread_mutex_t lock;
+    pthread_cond_t finished;
+} ReplayPool;
+
+// the job's volume, NULL after printing why it cannot be opened
+static Store *job_openStore(ReplayJob *job)
+{
+    Store *s;
+    if (job->imageName == NULL)
+    {
+        s = createStore(job->geometry, job->allocationType);
+        if (s != NULL && job->useFat)
         {
-            Block *readBlock = store_getBlock(s, i + blockIndex);
-            for (int j = 0; j < sizeof(readBlock[i].entries); ++j)
-            {
-                printf("Block read: %d \n", readBlock[i].entries[j]);
-            }
+            store_enableFat(s);
         }
-        printf("Time = %d reads\n", reads);
     }
-    else if (allocationType == ALLOC_LINKED)
+    else
     {
-        //Find actual file name
-        int fileActual = (fileName / 100) * 100;
-        int start = -1;
-        int end = -1;
-        int reads = 0;
-        for (int i = 0; i < s->fileEntrySize; i++)
+        // the journal sits next to the image
+        char *journalName = malloc(strlen(job->imageName) + 9);
+        sprintf(journalName, "%s.journal", job->imageName);
+        long long replayed = 0;
+        if (job->mountImage)
         {
-            reads++;
-            if (s->fileEntry[i].fileName == fileActual)
-            {
-                start = s->fileEntry[i].params[0];
-                end = s->fileEntry[i].params[1];
-                break;
-            }
+            s = store_mountImage(job->imageName, job->journalOps > 0 ? journalName : NULL, &replayed);
         }
-        if (start == -1)
+        else
         {
-            printf("File%d not found\n", fileName);
+            s = store_createImage(job->imageName, job->geometry, job->allocationType, job->useFat);
         }
-        else if (fileName == fileActual)
+        if (replayed > 0)
         {
-            printf("File %d found", fileName);
+            fprintf(job->text, "Replayed %lld journal commits into %s\n", replayed, job->imageName);
         }
-        else
+        if (s != NULL && job->journalOps > 0 && !store_openJournal(s, job->imageName, journalName, job->journalOps))
         {
-            Block b = s->blocks[start];
-            int found = 0;
-            int blockSize = s->vcb->blockSize;
-
-            //find block that contains filename
-            while (1)
-            {
-                //search block for filename
-                printf("Reading B%d(", b.index);
-                for (int i = 0; i < blockSize; i++)
-                {
-                    reads++;
-                    if (b.entries[i] != -1)
-                    {
-                        printf("%d ", b.entries[i]);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                    if (b.entries[i] == fileName)
-                    {
-                        printf(")\n");
-                        printf("File%d(%d) found in B%d\n", fileActual, fileName, b.index);
-                        found = 1;
-                        break;
-                    }
-                }
-                if (found == 1)
-                    break;
-                if (b.index != end)
-                {
-                    printf("), ");
-                    b = s->blocks[b.entries[blockSize - 1]];
-                    reads++;
-                }
-                else
-                    break;
-            }
-            if (found == 0)
-            {
-                printf(")\nFile%d not found\n", fileName);
-            }
-            printf("Time = %d reads\n", reads);
+            fprintf(job->text, "Cannot open journal %s\n", journalName);
+            freeStore(s);
+            free(journalName);
+            return NULL;
         }
+        free(journalName);
     }
-    else if (allocationType == ALLOC_INDEXED)
+
+    if (s == NULL && job->imageName != NULL)
     {
-        // try to find the fileEntry with fileName
-        FileEntry *fileEntry = NULL;
-        for (int i = 0; i < s->fileEntrySize; i++)
+        fprintf(job->text, "Cannot %s image %s\n", job->mountImage ? "mount" : "create", job->imageName);
+    }
+    else if (s == NULL)
+    {
+        fprintf(job->text, "Cannot create a volume of %lld blocks of %d entries with %d file entries\n", job->geometry.numBlocks, job->geometry.blockSize, job->geometry.fileEntrySize);
+    }
+    else
+    {
+        s->vcb->fitPolicy = job->fitPolicy;
+        if (job->useContentIndex)
         {
-            if (s->fileEntry[i].fileName == fileName)
-            {
-                fileEntry = s->fileEntry + i;
-                break;
-            }
+            s->contentIndex = contentIndex_create();
         }
-
-        // fileName found
-        if (fileEntry != NULL)
+        // an indexed image that has shared blocks keeps sharing them, or deleting a file would free blocks others still use
+        if ((job->useDedup || (job->mountImage && job->allocationType == ALLOC_INDEXED)) && store_enableDedup(s) == 0 && !job->useDedup)
         {
-            printf("Read file %d(%d) from directory structure\n", fileName, fileName);
-            return;
+            dedup_free(s->dedup);
+            s->dedup = NULL;
         }
-
-        // not found try to find from content
-        int entriesSize = s->numBlocks * s->vcb->blockSize;
-        const int *entries = s->blocks[0].entries;
-        int entryIndex = -1;
-        int reads = 0;
-        for (int i = 0; i < entriesSize; i++)
+        // reads by content go file by file once an image holds packed files
+        s->compress = job->compress;
+        for (int i = 0; i < s->fileEntrySize && job->mountImage; i++)
         {
-            reads++;
-            if (entries[i] == fileName)
-            {
-                entryIndex = i;
-                break;
-            }
+            s->compress |= s->fileEntry[i].fileName != 0 && s->fileEntry[i].packedBits != 0;
         }
-
-        if (entryIndex == -1)
+        if (job->cacheFrames > 0)
         {
-            printf("File with name and content of %d is not found\n", fileName);
-            printf("Time = %d reads\n", reads);
-            return;
+            s->cache = cache_create(job->cacheFrames, job->cachePolicy, s->numBlocks);
         }
-
-        int blockIndex = entryIndex / (double)s->vcb->blockSize;
-        fileEntry = NULL;
-        for (int i = 0; i < s->fileEntrySize; i++)
+        if (job->device != 0)
         {
-            fileEntry = s->fileEntry + i;
-            Block indexBlock = s->blocks[fileEntry->params[0]];
-            // check each fileEntry
-            int entryPosition = -1;
-            // find index block with content block index
-            for (int y = 0; y < s->vcb->blockSize; y++)
-            {
-                reads++;
-                if (indexBlock.entries[y] == blockIndex)
-                {
-                    entryPosition = y;
-                    break;
-                }
-            }
-            // when index block is found
-
-            if (entryPosition != -1)
-            {
-                // Read file100(106) from <you will decide how it can be processed>
-                printf("Read file %d(%d) from block %d\n", fileEntry->fileName, fileName, blockIndex);
-                break;
-            }
+            s->device = device_create(job->device, s->vcb->blockSize, s->numBlocks);
+        }
+        if (job->delayThreshold > 0)
+        {
+            store_enableDelayedAdds(s, job->delayThreshold);
         }
-        printf("Time = %d reads\n", reads);
     }
-    else if (allocationType == ALLOC_LINKEDCONTIG)
+    return s;
+}
+
+// flushes the cache and prints how well it did and how long the device was busy
+static void store_reportIo(FILE *text, Store *s)
+{
+    BlockCache *cache = s->cache;
+    if (cache != NULL)
     {
-        int fileActual = (fileName / 100) * 100;
-        int start = -1;
-        int end = -1;
-        int reads = 0;
-        for (int i = 0; i < s->fileEntrySize; i++)
+        store_syncCache(s);
+        long long accesses = cache->hits + cache->misses;
+        fprintf(text, "%s cache of %d blocks: %lld hits, %lld misses, hit ratio %.3f, %lld write-backs\n",
+                cache->policy == CACHE_CLOCK ? "CLOCK" : "LRU", cache->capacity, cache->hits, cache->misses,
+                accesses > 0 ? (double)cache->hits / accesses : 0.0, cache->writeBacks);
+    }
+    DeviceModel *device = s->device;
+    if (device != NULL)
+    {
+        fprintf(text, "%s time %.3f ms, %lld %s\n", device_name(device->type), device->time / 1e3, device->seeks,
+                device->type == DEVICE_HDD ? "seeks" : "random page accesses");
+    }
+    Journal *journal = s->vcb->journal;
+    if (journal != NULL)
+    {
+        journal_commit(journal);
+        fprintf(text, "Journal: %lld changes in %lld commits, %lld records, %.1f KiB logged, %lld checkpoints%s\n", journal->operations,
+                journal->commits, journal->records, journal->bytes / 1024.0, journal->checkpoints, journal->failed ? ", writing failed" : "");
+    }
+    DedupIndex *dedup = s->dedup;
+    if (dedup != NULL)
+    {
+        fprintf(text, "Dedup: %lld of %lld content blocks shared, %lld copied back for appends, %zu blocks indexed\n", dedup->shared,
+                dedup->shared + dedup->written, dedup->unshared, dedup->count);
+    }
+    if (s->compress)
+    {
+        fprintf(text, "Compression: %lld files packed, %lld content blocks saved, %lld unpacked to grow them\n", s->packedFiles,
+                s->packedSaved, s->unpackedFiles);
+    }
+    SnapshotSet *snapshots = s->vcb->snapshots;
+    if (snapshots != NULL)
+    {
+        int count = 0;
+        for (Snapshot *snap = snapshots->newest; snap != NULL; snap = snap->older)
         {
-            reads++;
-            if (s->fileEntry[i].fileName == fileActual)
-            {
-                start = s->fileEntry[i].params[0];
-                end = s->fileEntry[i].params[1];
-                break;
-            }
+            count++;
         }
-        if (start == -1)
+        fprintf(text, "Snapshots: %d kept, %lld blocks copied, %lld blocks handed over, %lld writes not preserved\n", count,
+                snapshots->copies, snapshots->kept, snapshots->lost);
+    }
+}
+
+// starts the job's background defragmenter, NULL when steps run between instructions or not at all
+static Defragmenter *job_startDefrag(ReplayJob *job, Store *s)
+{
+    if (job->defragMoves == 0 || !job->defragThread)
+    {
+        return NULL;
+    }
+    Defragmenter *defrag = malloc(sizeof(Defragmenter));
+    defrag_start(defrag, s, job->defragMoves);
+    return defrag;
+}
+
+// applies one instruction while the background defragmenter, if any, waits
+static int job_apply(ReplayJob *job, Store *s, Defragmenter *defrag, const Instruction *instruction)
+{
+    if (defrag == NULL)
+    {
+        return store_apply(s, job->allocationType, instruction);
+    }
+    pthread_mutex_lock(&defrag->lock);
+    int status = store_apply(s, job->allocationType, instruction);
+    pthread_mutex_unlock(&defrag->lock);
+    return status;
+}
+
+// places the adds still held by delayed allocation and adds their outcomes to statusCount
+static void job_flushDelayed(Store *s, Defragmenter *defrag, size_t *statusCount)
+{
+    if (s->delayed == NULL)
+    {
+        return;
+    }
+    if (defrag != NULL)
+    {
+        pthread_mutex_lock(&defrag->lock);
+    }
+    store_flushDelayed(s);
+    if (defrag != NULL)
+    {
+        pthread_mutex_unlock(&defrag->lock);
+    }
+    for (int i = 0; i <= STATUS_NO_ENTRY; i++)
+    {
+        statusCount[i] += s->delayed->statusCount[i];
+    }
+}
+
+static void job_stopDefrag(ReplayJob *job, Store *s, Defragmenter *defrag, FILE *text)
+{
+    if (defrag != NULL)
+    {
+        defrag_stop(defrag);
+        free(defrag);
+    }
+    if (job->defragMoves > 0)
+    {
+        ExtentTree *extents = &s->vcb->extents;
+        fprintf(text, "Defragmenter moved %lld blocks of %lld files, %d free extents, largest %lld\n", s->defragMoves, s->defragFiles,
+                extents->count, extents->byStart == -1 ? 0 : extents->nodes[extents->byStart].maxLength);
+    }
+}
+
+void replay_run(ReplayJob *job)
+{
+    fprintf(job->text, "\nAllocation type: %s\n", job->name);
+
+    Store *s = job_openStore(job);
+    if (s == NULL)
+    {
+        job->failed = 1;
+        return;
+    }
+    s->output.verbose = !job->quiet;
+    s->output.text = job->text;
+    s->output.eventFile = job->events;
+    // printf("Block size: %d\n", s->vcb->blockSize);
+    // printf("File Entries: %d\n", s->fileEntrySize);
+    // printf("Blocks %d\n", s->numBlocks);
+    // printf("Free Blocks %d\n", s->vcb->freeBlockNum);
+    size_t instructionCount = job->list->count;
+    size_t statusCount[STATUS_DELAYED + 1] = {0};
+    Defragmenter *defrag = job_startDefrag(job, s);
+    for (size_t x = 0; x < instructionCount; x++)
+    {
+        statusCount[job_apply(job, s, defrag, job->list->items + x)]++;
+        if (defrag == NULL && job->defragMoves > 0)
         {
-            printf("File%d not found\n", fileName);
-            return;
+            store_defragStep(s, job->defragMoves);
         }
-        else if (fileName == fileActual)
+        if (job->metricsEvery > 0 && (x + 1) % job->metricsEvery == 0)
         {
-            printf("File %d found\n", fileName);
+            char label[64];
+            sprintf(label, "Metrics after %zu instructions", x + 1);
+            store_printMetrics(s, job->text, label);
         }
-        else
+        if (x + 1 == job->crashAfter)
         {
-            Block b = s->blocks[start];
-            int found = 0;
-            int blockSize = s->vcb->blockSize;
-
-            //find block that contains filename
-            while (1)
-            {
-                //search block for filename
-                printf("Reading B%d(", b.index);
-                for (int i = 0; i < blockSize; i++)
-                {
-                    reads++;
-                    if (b.entries[i] != -1)
-                    {
-                        printf("%d ", b.entries[i]);
-                    }
-                    else
-                    {
-                        break;
-                    }
-                    if (b.entries[i] == fileName)
-                    {
-                        printf(")\n");
-                        printf("File%d(%d) found in B%d\n", fileActual, fileName, b.index);
-                        found = 1;
-                        break;
-                    }
-                }
-                if (found == 1)
-                    break;
-                if (b.index != end)
-                {
-                    printf("), ");
-                    if (b.entries[blockSize - 1] < fileActual)
-                    {
-                        b = s->blocks[b.entries[blockSize - 1]];
-                    }
-                    else
-                    {
-                        b = s->blocks[b.index + 1];
-                    }
-                    reads++;
-                }
-                else
-                    break;
-            }
-            if (found == 0)
-            {
-                printf(")\nFile%d not found\n", fileName);
-            }
-            printf("Time = %d reads\n", reads);
+            // the image is left as a crash would leave it, only the journal's complete groups survive
+            fprintf(job->text, "\nCrashed after %zu instructions\n", x + 1);
+            fflush(NULL);
+            _exit(0);
         }
     }
+    job_flushDelayed(s, defrag, statusCount);
+    job_stopDefrag(job, s, defrag, job->text);
+    if (job->metricsEvery > 0)
+    {
+        store_printMetrics(s, job->text, "Metrics");
+    }
+
+    store_print(s);
+    if (job->quiet)
+    {
+        fprintf(job->text, "%zu instructions: %zu ok, %zu exists, %zu not found, %zu no space, %zu no file entry, %lld of %lld blocks free\n",
+                instructionCount, statusCount[STATUS_OK], statusCount[STATUS_EXISTS], statusCount[STATUS_NOT_FOUND],
+                statusCount[STATUS_NO_SPACE], statusCount[STATUS_NO_ENTRY], s->vcb->freeBlockNum, s->numBlocks);
+    }
+    if (s->delayed != NULL)
+    {
+        fprintf(job->text, "Delayed allocation: %lld batches, %lld placed in one free run\n", s->delayed->batches, s->delayed->packedBatches);
+    }
+    store_reportIo(job->text, s);
+
+    freeStore(s);
 }
 
-void store_delete(Store *s, int allocationType, int fileName)
+static void *replay_worker(void *arg)
 {
-    if (fileName % 100 != 0)
+    ReplayPool *pool = arg;
+    while (1)
     {
-        fileName = (fileName / 100) * 100;
+        pthread_mutex_lock(&pool->lock);
+        int index = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        if (index >= pool->jobCount)
+        {
+            break;
+        }
+        replay_run(pool->jobs + index);
+        pthread_mutex_lock(&pool->lock);
+        pool->jobs[index].done = 1;
+        pthread_cond_broadcast(&pool->finished);
+        pthread_mutex_unlock(&pool->lock);
     }
-    if (allocationType == ALLOC_CONTIGUOUS)
+    return NULL;
+}
+
+// appends everything written to from, which is then closed
+static void copyFile(FILE *from, FILE *to)
+{
+    char buffer[1 << 16];
+    size_t n;
+    rewind(from);
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0)
     {
+        fwrite(buffer, 1, n, to);
+    }
+    fclose(from);
+}
 
-        int blockIndex = -1;
-        int requiredBlocks = -1;
-        FileEntry *fileEntry = NULL;
-        //find the file entry where file is stored
-        for (int i = 0; i < s->vcb->blockSize; ++i)
+// replays every job on up to threadCount workers, output is emitted in job order
+int replay_parallel(ReplayJob *jobs, int jobCount, int threadCount, FILE *eventFile)
+{
+    for (int j = 0; j < jobCount; j++)
+    {
+        jobs[j].text = tmpfile();
+        jobs[j].events = eventFile != NULL ? tmpfile() : NULL;
+        if (jobs[j].text == NULL || (eventFile != NULL && jobs[j].events == NULL))
         {
-            fileEntry = s->fileEntry + i;
-            if (fileEntry->fileName == fileName)
-            {
-                blockIndex = fileEntry->params[0];
-                requiredBlocks = fileEntry->params[1];
-                break;
-            }
+            printf("Cannot create a temporary file for the replay output\n");
+            return 0;
         }
+    }
 
-        if (fileEntry != NULL)
-        {
-            if (blockIndex != -1 && requiredBlocks != -1 && blockIndex < s->numBlocks)
-            {
-                //delete block
-                Block *deleteBlock = store_getBlock(s, blockIndex);
-                int totalEntries = requiredBlocks * s->fileEntrySize;
+    ReplayPool pool;
+    pool.jobs = jobs;
+    pool.jobCount = jobCount;
+    pool.next = 0;
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.finished, NULL);
+    if (threadCount > jobCount)
+    {
+        threadCount = jobCount;
+    }
+    pthread_t *threads = malloc(sizeof(pthread_t) * threadCount);
+    for (int t = 0; t < threadCount; t++)
+    {
+        pthread_create(threads + t, NULL, replay_worker, &pool);
+    }
 
-                VolumeControlBlock *deleteVcb = s->vcb;
-                //free block
-                vcb_freeBlock(deleteVcb, deleteBlock);
-            }
-            //set the file entry parameters back to 0
-            fileEntry->fileName = 0;
-            fileEntry->allocationType = ALLOC_CONTIGUOUS;
-            fileEntry->params[0] = 0;
-            fileEntry->params[1] = 0;
-            printf("Deleted file %d and freed B%d \n", fileName, blockIndex);
+    // emit each job as soon as it and every job before it are done
+    for (int j = 0; j < jobCount; j++)
+    {
+        pthread_mutex_lock(&pool.lock);
+        while (!jobs[j].done)
+        {
+            pthread_cond_wait(&pool.finished, &pool.lock);
         }
-        else
+        pthread_mutex_unlock(&pool.lock);
+        copyFile(jobs[j].text, stdout);
+        if (jobs[j].events != NULL)
         {
-            printf("No file found \n");
+            copyFile(jobs[j].events, eventFile);
         }
     }
-    else if (allocationType == ALLOC_LINKED)
+
+    for (int t = 0; t < threadCount; t++)
+    {
+        pthread_join(threads[t], NULL);
+    }
+    free(threads);
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.finished);
+    return 1;
+}
+
+// parameters of a generated workload
+typedef struct benchConfig
+{
+    long long ops;
+    // relative weights of add, read, delete, read by offset and append, fallocate is never generated
+    int mix[ACTION_COUNT];
+    // percent of the volume's entries that live files may hold
+    int fill;
+    int maxSize;
+    // 1 draws mostly small files, 0 draws sizes uniformly
+    int skewed;
+    uint64_t seed;
+} BenchConfig;
+
+static uint64_t bench_random(uint64_t *state)
+{
+    *state ^= *state >> 12;
+    *state ^= *state << 25;
+    *state ^= *state >> 27;
+    return *state * 2685821657736338717ULL;
+}
+
+// files look like fulltest.csv: the name is a multiple of 100 and the contents follow it
+void bench_generate(const BenchConfig *config, long long volumeEntries, InstructionList *list)
+{
+    instructions_init(list);
+    uint64_t state = config->seed != 0 ? config->seed : 1;
+    int *liveNames = malloc(sizeof(int) * (config->ops + 1));
+    int *liveSizes = malloc(sizeof(int) * (config->ops + 1));
+    int liveCount = 0;
+    long long liveEntries = 0;
+    long long limit = volumeEntries * config->fill / 100;
+    int nextName = 100;
+    int total = 0;
+    for (int a = 0; a < ACTION_COUNT; a++)
+    {
+        total += config->mix[a];
+    }
+
+    for (long long op = 0; op < config->ops; op++)
     {
-        FileEntry *fe = NULL;
-        int start = -1;
-        int end = -1;
-        //Find file entry that contains filename and set the start and end
-        for (int i = 0; i < s->fileEntrySize; i++)
+        int pick = bench_random(&state) % total;
+        int action = ACTION_ADD;
+        while (pick >= config->mix[action - 1])
+        {
+            pick -= config->mix[action - 1];
+            action++;
+        }
+        int size = 0;
+        if (action == ACTION_ADD)
         {
-            if (s->fileEntry[i].fileName == fileName)
+            double u = (bench_random(&state) >> 11) * (1.0 / 9007199254740992.0);
+            size = config->skewed ? (int)(config->maxSize * u * u * u) : (int)((config->maxSize + 1) * u);
+            // past the fill level the volume makes room instead of growing
+            if (liveEntries + size > limit && liveCount > 0)
             {
-                fe = &s->fileEntry[i];
-                start = s->fileEntry[i].params[0];
-                end = s->fileEntry[i].params[1];
-                break;
+                action = ACTION_DELETE;
             }
         }
-        if (start == -1)
+        else if (liveCount == 0)
         {
-            printf("File%d not found", fileName);
+            action = ACTION_ADD;
         }
-        else
+        int victim = action != ACTION_ADD ? bench_random(&state) % liveCount : 0;
+        if (action == ACTION_APPEND)
         {
-            //clear the filentry data
-            fe->fileName = 0;
-            fe->params[0] = 0;
-            fe->params[1] = 0;
-            printf("Deleted file %d and freed ", fileName);
-            int blockSize = s->vcb->blockSize;
-            int temp = start;
-            Block *b = NULL;
-            //free the blocks from start to end
-            do
+            // a few more values, as long as the file stays below the next name
+            int room = BENCH_MAX_SIZE - liveSizes[victim];
+            size = room < 1 ? 0 : 1 + bench_random(&state) % (room < 8 ? room : 8);
+            if (size == 0)
             {
-                b = &s->blocks[temp];
-                temp = s->blocks[temp].entries[blockSize - 1];
-                vcb_freeBlock(s->vcb, b);
-                printf("B%d ", b->index);
-            } while (b->index != end);
-            printf("\n");
-        }
-    }
-    else if (allocationType == ALLOC_INDEXED)
-    {
-        int indexBlock = -1;
-        FileEntry *fileEntry = NULL;
-        int found = 0;
-        for (int i = 0; i < s->vcb->blockSize; ++i)
-        {
-            fileEntry = s->fileEntry + i;
-            //finds the filename
-            if (fileEntry->fileName == fileName)
+                action = ACTION_READ;
+            }
+            else if (liveEntries + size > limit)
             {
-                found = 1;
-                indexBlock = fileEntry->params[0];
-                if (indexBlock != -1)
-                {
-                    Block *deleteBlockIndex = store_getBlock(s, indexBlock); //get the block that contains the index
-                    for (int y = 0; y < s->vcb->blockSize; y++)
-                    {
-                        int contentBlockIndex = deleteBlockIndex->entries[y];
-                        Block *deleteBlock = store_getBlock(s, contentBlockIndex); //get the block that contais the data
-                        if (contentBlockIndex == -1)
-                        {
-                            break;
-                        }
-                        else
-                        {
-                            vcb_freeBlock(s->vcb, deleteBlock);
-                        }
-                    }
-                    //clearing the Volume Control Block
-                    VolumeControlBlock *deleteVCB = s->vcb;
-                    vcb_freeBlock(deleteVCB, deleteBlockIndex);
-
-                    fileEntry->fileName = 0;
-                    fileEntry->allocationType = ALLOC_INDEXED;
-                    fileEntry->params[0] = 0;
-                    fileEntry->params[1] = 0;
-                    printf("Deleted file %d and freed B%d \n", fileName, indexBlock);
-                }
-                break;
+                action = ACTION_DELETE;
             }
         }
-        if (!found)
-        {
-            printf("File %d is not found!\n", fileName);
-        }
-    }
-    else if (allocationType == ALLOC_LINKEDCONTIG)
-    {
-        FileEntry *fe = NULL;
-        int start = -1;
-        int end = -1;
-        //Find file entry that contains filename and set the start and end
-        for (int i = 0; i < s->fileEntrySize; i++)
+
+        if (action == ACTION_ADD)
         {
-            if (s->fileEntry[i].fileName == fileName)
+            Instruction *instruction = instructions_push(list, ACTION_ADD, nextName);
+            for (int i = 1; i <= size; i++)
             {
-                fe = &s->fileEntry[i];
-                start = s->fileEntry[i].params[0];
-                end = s->fileEntry[i].params[1];
-                break;
+                instructions_pushContent(list, instruction, nextName + i);
             }
+            liveNames[liveCount] = nextName;
+            liveSizes[liveCount] = size;
+            liveCount++;
+            liveEntries += size;
+            nextName += 100;
         }
-        if (start == -1)
+        else if (action == ACTION_APPEND)
         {
-            printf("File%d not found\n", fileName);
-            return;
+            Instruction *instruction = instructions_push(list, ACTION_APPEND, liveNames[victim]);
+            for (int i = 1; i <= size; i++)
+            {
+                instructions_pushContent(list, instruction, liveNames[victim] + liveSizes[victim] + i);
+            }
+            liveSizes[victim] += size;
+            liveEntries += size;
         }
-        fe->fileName = 0;
-        fe->params[0] = 0;
-        fe->params[1] = 0;
-        printf("Deleted file %d and freed ", fileName);
-        int blockSize = s->vcb->blockSize;
-        int temp = start;
-        Block *b = NULL;
-        do
+        else
         {
-            b = &s->blocks[temp];
-            if (b->entries[blockSize - 1] < fileName)
+            if (action == ACTION_READ)
+            {
+                // half the reads are by name, the rest by one of the file's values
+                int fileName = liveNames[victim];
+                if (liveSizes[victim] > 0 && bench_random(&state) % 2 == 0)
+                {
+                    fileName += 1 + bench_random(&state) % liveSizes[victim];
+                }
+                instructions_push(list, ACTION_READ, fileName);
+            }
+            else if (action == ACTION_RANGE)
             {
-                temp = b->entries[blockSize - 1];
+                // a random slice of the file, empty files are read from 0
+                Instruction *instruction = instructions_push(list, ACTION_RANGE, liveNames[victim]);
+                int size = liveSizes[victim];
+                int from = size > 0 ? bench_random(&state) % size : 0;
+                instructions_pushContent(list, instruction, from);
+                instructions_pushContent(list, instruction, size > 0 ? 1 + bench_random(&state) % (size - from) : 1);
             }
             else
             {
-                temp = b->index + 1;
+                instructions_push(list, ACTION_DELETE, liveNames[victim]);
+                liveEntries -= liveSizes[victim];
+                liveCount--;
+                liveNames[victim] = liveNames[liveCount];
+                liveSizes[victim] = liveSizes[liveCount];
             }
-            vcb_freeBlock(s->vcb, b);
-            printf("B%d ", b->index);
-        } while (b->index != end);
-        printf("\n");
+        }
     }
+    free(liveNames);
+    free(liveSizes);
+    instructions_finish(list);
 }
 
-void store_print(Store *store)
+static int compareLongLong(const void *a, const void *b)
 {
-    printf("%20s%20s%20s\n", "Index", "Block", "File Data");
-    printf("%20s%20s%20s\n", "0", "-", "<v.ctrl B>");
-    int i, y;
-    char fileEntryStr[100] = "\0";
-    for (i = 0; i < store->fileEntrySize; i++)
+    long long x = *(const long long *)a;
+    long long y = *(const long long *)b;
+    return (x > y) - (x < y);
+}
+
+static long long elapsedNs(struct timespec from, struct timespec to)
+{
+    return (to.tv_sec - from.tv_sec) * 1000000000LL + (to.tv_nsec - from.tv_nsec);
+}
+
+// replays the job quietly and reports throughput, latency, work and fragmentation
+void bench_run(ReplayJob *job)
+{
+    printf("\nAllocation type: %s\n", job->name);
+
+    Store *s = job_openStore(job);
+    if (s == NULL)
     {
-        if (store->fileEntry[i].allocationType == ALLOC_INDEXED)
+        job->failed = 1;
+        return;
+    }
+    s->output.verbose = 0;
+    s->output.eventFile = job->events;
+
+    size_t count = job->list->count;
+    // latencies per action, ACTION_ADD - 1 to ACTION_COUNT - 1
+    long long *latency[ACTION_COUNT];
+    size_t latencyCount[ACTION_COUNT] = {0};
+    for (int a = 0; a < ACTION_COUNT; a++)
+    {
+        latency[a] = malloc(sizeof(long long) * (count + 1));
+    }
+    size_t failedOps = 0;
+    // simulated device time per action
+    double deviceTime[ACTION_COUNT] = {0};
+    Defragmenter *defrag = job_startDefrag(job, s);
+    struct timespec start, before, after;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    before = start;
+    for (size_t x = 0; x < count; x++)
+    {
+        const Instruction *instruction = job->list->items + x;
+        double deviceBefore = s->device != NULL ? s->device->time : 0;
+        int status = job_apply(job, s, defrag, instruction);
+        if (status != STATUS_OK && status != STATUS_DELAYED)
         {
-            sprintf(fileEntryStr, "%d,%d", store->fileEntry[i].fileName, store->fileEntry[i].params[0]);
+            failedOps++;
         }
-        else
+        clock_gettime(CLOCK_MONOTONIC, &after);
+        int a = instruction->action - 1;
+        deviceTime[a] += s->device != NULL ? s->device->time - deviceBefore : 0;
+        latency[a][latencyCount[a]++] = elapsedNs(before, after);
+        before = after;
+        // steps between instructions count in the throughput but not in any latency
+        if (defrag == NULL && job->defragMoves > 0)
+        {
+            store_defragStep(s, job->defragMoves);
+            clock_gettime(CLOCK_MONOTONIC, &before);
+        }
+        if (job->metricsEvery > 0 && (x + 1) % job->metricsEvery == 0)
         {
-            sprintf(fileEntryStr, "%d,%d,%d", store->fileEntry[i].fileName, store->fileEntry[i].params[0], store->fileEntry[i].params[1]);
+            char label[64];
+            sprintf(label, "Metrics after %zu ops", x + 1);
+            store_printMetrics(s, stdout, label);
+            clock_gettime(CLOCK_MONOTONIC, &before);
         }
-        printf("%20d%20s%20s\n", 1 + i, "-", fileEntryStr);
     }
+    // the last batch is placed inside the timed run
+    size_t delayedStatus[STATUS_DELAYED + 1] = {0};
+    job_flushDelayed(s, defrag, delayedStatus);
+    clock_gettime(CLOCK_MONOTONIC, &after);
+    failedOps += delayedStatus[STATUS_EXISTS] + delayedStatus[STATUS_NOT_FOUND] + delayedStatus[STATUS_NO_SPACE] + delayedStatus[STATUS_NO_ENTRY];
+    double seconds = elapsedNs(start, after) / 1e9;
+    job_stopDefrag(job, s, defrag, stdout);
 
-    for (i = 0; i < store->numBlocks; i++)
+    printf("%zu ops in %.3f s, %.0f ops/sec, %zu failed\n", count, seconds, seconds > 0 ? count / seconds : 0.0, failedOps);
+    for (int a = 0; a < ACTION_COUNT; a++)
     {
-        for (y = 0; y < store->vcb->blockSize; y++)
+        size_t n = latencyCount[a];
+        if (n == 0 && a + 1 > ACTION_DELETE)
+        {
+            free(latency[a]);
+            continue;
+        }
+        qsort(latency[a], n, sizeof(long long), compareLongLong);
+        printf("%-6s %10zu ops, p50 %.2f us, p99 %.2f us", actionName(a + 1), n,
+               n > 0 ? latency[a][n / 2] / 1e3 : 0.0, n > 0 ? latency[a][n * 99 / 100] / 1e3 : 0.0);
+        if (s->device != NULL)
         {
-            int index = store->fileEntrySize + 1 + y + i * store->vcb->blockSize;
-            printf("%20d%20d%20d\n", index, store->blocks[i].index, store->blocks[i].entries[y]);
+            printf(", %s %.2f us/op", device_name(s->device->type), n > 0 ? deviceTime[a] / n : 0.0);
         }
+        printf("\n");
+        free(latency[a]);
     }
-}
+    printf("%.2f traversals/op, %.2f reads/op\n", count > 0 ? (double)s->traversals / count : 0.0, count > 0 ? (double)s->reads / count : 0.0);
 
-char *readCsv()
-{
-    FILE *f = fopen(CSV_NAME, "rb");
-    // find out the number of chars of the text
-    fseek(f, 0, SEEK_END);
-    long fsize = ftell(f);
-    fseek(f, 0, SEEK_SET);
+    // fragmentation is the share of free blocks outside the largest free extent
+    ExtentTree *extents = &s->vcb->extents;
+    BlockNo largest = extents->byStart == -1 ? 0 : extents->nodes[extents->byStart].maxLength;
+    BlockNo freeBlocks = s->vcb->freeBlockNum;
+    printf("%lld free blocks in %d extents, largest %lld, fragmentation %.3f\n", freeBlocks, extents->count, largest,
+           freeBlocks > 0 ? 1.0 - (double)largest / freeBlocks : 0.0);
+    store_printMetrics(s, stdout, "Metrics");
+    if (s->buddy != NULL)
+    {
+        printf("%lld buddy splits, %lld merges\n", s->buddy->splits, s->buddy->merges);
+    }
+    if (s->delayed != NULL)
+    {
+        printf("%lld delayed batches, %lld placed in one free run\n", s->delayed->batches, s->delayed->packedBatches);
+    }
+    store_reportIo(stdout, s);
 
-    // + 1 for null character
-    char *text = malloc(sizeof(char) * (fsize + 1));
-    fread(text, fsize, 1, f);
-    text[fsize] = '\0';
-    fclose(f);
-    return text;
+    freeStore(s);
 }
 
-char **splitString(char *text, const char *delimiter)
+// one client of the stress benchmark, it replays the files with fileName / 100 % threads == thread
+typedef struct stressClient
 {
-    int resultCount = 0;
-    int resultSize = 5;
-    char **result = malloc(sizeof(char *) * resultSize);
-    char *iterator = text;
-    char *lineBreak = strstr(iterator, delimiter);
-    char *line;
-    size_t length;
-    while (lineBreak != NULL)
-    {
-        length = lineBreak - iterator;
-        line = malloc(sizeof(char) * (length + 1));
-        strncpy(line, iterator, length);
-        line[length] = '\0';
-        iterator = lineBreak + 1;
-        result[resultCount] = line;
-        resultCount++;
-        lineBreak = strstr(iterator, delimiter);
-
-        // printf("%s\n", line);
+    Store *store;
+    int allocationType;
+    const InstructionList *list;
+    int thread;
+    int threads;
+    size_t ops;
+    size_t failedOps;
+} StressClient;
 
-        if (resultCount == resultSize)
+static void *stress_client(void *arg)
+{
+    StressClient *client = arg;
+    for (size_t x = 0; x < client->list->count; x++)
+    {
+        const Instruction *instruction = client->list->items + x;
+        if (instruction->fileName / 100 % client->threads != client->thread)
+        {
+            continue;
+        }
+        client->ops++;
+        if (store_apply(client->store, client->allocationType, instruction) != STATUS_OK)
         {
-            resultSize = resultSize * 2;
-            result = realloc(result, sizeof(char *) * resultSize);
+            client->failedOps++;
         }
     }
+    return NULL;
+}
 
-    length = strlen(iterator);
-    line = malloc(sizeof(char) * (length + 1));
-    strncpy(line, iterator, length);
-    line[length] = '\0';
-    result[resultCount] = line;
-    resultCount++;
+// replays the job on 1, 2, 4 and so on up to maxThreads clients sharing one volume
+void stress_run(ReplayJob *job, int maxThreads)
+{
+    printf("\nAllocation type: %s\n", job->name);
 
-    if (resultCount == resultSize)
+    double baseRate = 0;
+    for (int threads = 1; threads <= maxThreads; threads = threads < maxThreads && threads * 2 > maxThreads ? maxThreads : threads * 2)
     {
-        result = realloc(result, sizeof(char *) * (resultSize + 1));
+        Store *s = job_openStore(job);
+        if (s == NULL)
+        {
+            job->failed = 1;
+            return;
+        }
+        s->output.verbose = 0;
+        store_enableLocks(s);
+
+        StressClient *clients = malloc(sizeof(StressClient) * threads);
+        pthread_t *workers = malloc(sizeof(pthread_t) * threads);
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (int t = 0; t < threads; t++)
+        {
+            clients[t] = (StressClient){s, job->allocationType, job->list, t, threads, 0, 0};
+            pthread_create(workers + t, NULL, stress_client, clients + t);
+        }
+        size_t ops = 0;
+        size_t failedOps = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            pthread_join(workers[t], NULL);
+            ops += clients[t].ops;
+            failedOps += clients[t].failedOps;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double seconds = elapsedNs(start, end) / 1e9;
+        double rate = seconds > 0 ? ops / seconds : 0.0;
+        if (threads == 1)
+        {
+            baseRate = rate;
+        }
+        printf("%3d threads: %zu ops in %.3f s, %.0f ops/sec, %.2fx, %zu failed\n", threads, ops, seconds, rate,
+               baseRate > 0 ? rate / baseRate : 0.0, failedOps);
+
+        free(clients);
+        free(workers);
+        freeStore(s);
     }
-    result[resultCount] = NULL;
-    // printf("%s\n", line);
-    // printf("end split\n");
-    return result;
 }
 
-void freeSplittedString(char **splittedStr)
+void printUsage(const char *program)
 {
-    for (int x = 0; splittedStr[x] != NULL; x++)
-        free(splittedStr[x]);
-    free(splittedStr);
+    printf("Usage: %s [--block-size N] [--blocks N] [--files N] [--entries N] [--fit first|best|worst] [--content-index] [--dedup] [--compress] [--quiet] [--events FILE] [--jobs N] [--alloc TYPE] [--fat] [--image FILE] [--journal N] [--crash-after N] [--cache N] [--cache-policy lru|clock] [--device hdd|ssd|nvme] [--defrag N] [--defrag-thread] [--delay N] [--metrics N] [--csv FILE]\n", program);
+    printf("       %s --bench [--ops N] [--mix ADD:READ:DELETE[:RANGE[:APPEND]]] [--fill PERCENT] [--max-size N] [--dist uniform|skewed] [--seed N] [volume options]\n", program);
+    printf("       %s --stress THREADS [workload and volume options]\n", program);
+    printf("  --block-size N  entries per block, asked for when not given\n");
+    printf("  --blocks N      number of data blocks in the volume\n");
+    printf("  --files N       number of file entries in the directory\n");
+    printf("  --entries N     split a volume of N entries like the %d entry default\n", ENTRIES);
+    printf("  --fit POLICY    how contiguous files pick a free run, first by default\n");
+    printf("  --content-index keep an index from content to block for reads by content\n");
+    printf("  --dedup         share identical content blocks between indexed files\n");
+    printf("  --compress      pack indexed content blocks by frame of reference when that saves blocks\n");
+    printf("  --quiet         only print a summary line per allocation type\n");
+    printf("  --events FILE   write a binary record of every replayed instruction\n");
+    printf("  --jobs N        replay the allocation types on N threads, 1 by default\n");
+    printf("  --alloc TYPE    only replay contiguous, linked, indexed, linked-contiguous or buddy\n");
+    printf("  --fat           keep the chains of linked files in a table instead of the blocks\n");
+    printf("  --image FILE    keep the volume in FILE, mounted when it exists and created otherwise\n");
+    printf("  --journal N     keep the image crash-safe with a journal, committing every N changes\n");
+    printf("  --crash-after N stop after N instructions without closing the image, to test the journal\n");
+    printf("  --cache N       count hits and misses of a buffer cache of N blocks in front of the volume\n");
+    printf("  --cache-policy P evict the least recently used block (lru, the default) or by clock\n");
+    printf("  --device D      time the block accesses as a hdd, ssd or nvme device would take them\n");
+    printf("  --defrag N      move up to N blocks of contiguous and linked contiguous files after every instruction\n");
+    printf("  --defrag-thread take the defragmentation steps on a background thread instead\n");
+    printf("  --delay N       hold adds back and place them N at a time, largest first, or before any other instruction\n");
+    printf("  --metrics N     print free space and file layout metrics every N instructions and at the end\n");
+    printf("  --csv FILE      instructions to replay, %s by default\n", CSV_NAME);
+    printf("  --bench         replay a generated workload and report ops/sec, latency, work and fragmentation\n");
+    printf("  --ops N         operations in the workload, 100000 by default\n");
+    printf("  --mix A:R:D:O:G relative weights of adds, reads, deletes, reads by offset and appends, 40:40:20:0:0 by default\n");
+    printf("  --fill PERCENT  share of the volume live files may hold, 50 by default\n");
+    printf("  --max-size N    largest file in entries, at most %d, 32 by default\n", BENCH_MAX_SIZE);
+    printf("  --dist D        file sizes drawn uniformly or skewed to small files\n");
+    printf("  --seed N        seed of the workload, 1 by default\n");
+    printf("  --stress N      replay the workload on 1, 2, 4 up to N client threads sharing each volume\n");
 }
 
-int main()
+int main(int argc, char **argv)
 {
-    char *csvText = readCsv();
-    // start with 5
-    int instructionSize = 5;
-    int instructionCount = 0;
-    Instruction *instructions = calloc(instructionSize, sizeof(Instruction));
-
-    // printf("csv content, \n%s\n", csvText);
-
-    char **lines = splitString(csvText, "\n");
-    int x;
-    for (x = 0; lines[x] != NULL; x++)
+    // volume geometry, by default derived from a volume of ENTRIES entries
+    long long volumeEntries = ENTRIES;
+    BlockNo numBlocks = 0;
+    int fileEntrySize = 0;
+    int block_size = 0;
+    int fitPolicy = FIT_FIRST;
+    int useContentIndex = 0;
+    int useDedup = 0;
+    int compress = 0;
+    int quiet = 0;
+    int jobCount = 1;
+    const char *csvName = CSV_NAME;
+    const char *eventsName = NULL;
+    int bench = 0;
+    int stressThreads = 0;
+    int allocFilter = 0;
+    int useFat = 0;
+    int cacheFrames = 0;
+    int cachePolicy = CACHE_LRU;
+    int device = 0;
+    BlockNo defragMoves = 0;
+    int defragThread = 0;
+    long long metricsEvery = 0;
+    const char *imageName = NULL;
+    int journalOps = 0;
+    long long crashAfter = 0;
+    int delayThreshold = 0;
+    BenchConfig benchConfig = {100000, {40, 40, 20, 0}, 50, 32, 0, 1};
+    for (int a = 1; a < argc; a++)
     {
-        if (x == instructionSize)
+        if (strcmp(argv[a], "--block-size") == 0 && a + 1 < argc)
+        {
+            block_size = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--blocks") == 0 && a + 1 < argc)
+        {
+            numBlocks = atoll(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--files") == 0 && a + 1 < argc)
+        {
+            fileEntrySize = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--entries") == 0 && a + 1 < argc)
+        {
+            volumeEntries = atoll(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--csv") == 0 && a + 1 < argc)
+        {
+            csvName = argv[++a];
+        }
+        else if (strcmp(argv[a], "--events") == 0 && a + 1 < argc)
+        {
+            eventsName = argv[++a];
+        }
+        else if (strcmp(argv[a], "--jobs") == 0 && a + 1 < argc)
+        {
+            jobCount = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--fat") == 0)
+        {
+            useFat = 1;
+        }
+        else if (strcmp(argv[a], "--device") == 0 && a + 1 < argc && strcmp(argv[a + 1], "hdd") == 0)
+        {
+            device = DEVICE_HDD;
+            a++;
+        }
+        else if (strcmp(argv[a], "--device") == 0 && a + 1 < argc && strcmp(argv[a + 1], "ssd") == 0)
         {
-            int tmp = instructionSize;
-            instructionSize += 5;
-            instructions = realloc(instructions, sizeof(Instruction) * instructionSize);
-            for (; tmp < instructionSize; tmp++)
+            device = DEVICE_SSD;
+            a++;
+        }
+        else if (strcmp(argv[a], "--device") == 0 && a + 1 < argc && strcmp(argv[a + 1], "nvme") == 0)
+        {
+            device = DEVICE_NVME;
+            a++;
+        }
+        else if (strcmp(argv[a], "--defrag") == 0 && a + 1 < argc)
+        {
+            defragMoves = atoll(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--metrics") == 0 && a + 1 < argc)
+        {
+            metricsEvery = atoll(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--defrag-thread") == 0)
+        {
+            defragThread = 1;
+        }
+        else if (strcmp(argv[a], "--cache") == 0 && a + 1 < argc)
+        {
+            cacheFrames = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--cache-policy") == 0 && a + 1 < argc && strcmp(argv[a + 1], "lru") == 0)
+        {
+            cachePolicy = CACHE_LRU;
+            a++;
+        }
+        else if (strcmp(argv[a], "--cache-policy") == 0 && a + 1 < argc && strcmp(argv[a + 1], "clock") == 0)
+        {
+            cachePolicy = CACHE_CLOCK;
+            a++;
+        }
+        else if (strcmp(argv[a], "--image") == 0 && a + 1 < argc)
+        {
+            imageName = argv[++a];
+        }
+        else if (strcmp(argv[a], "--journal") == 0 && a + 1 < argc)
+        {
+            journalOps = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--crash-after") == 0 && a + 1 < argc)
+        {
+            crashAfter = atoll(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--delay") == 0 && a + 1 < argc)
+        {
+            delayThreshold = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--alloc") == 0 && a + 1 < argc && strcmp(argv[a + 1], "contiguous") == 0)
+        {
+            allocFilter = ALLOC_CONTIGUOUS;
+            a++;
+        }
+        else if (strcmp(argv[a], "--alloc") == 0 && a + 1 < argc && strcmp(argv[a + 1], "linked") == 0)
+        {
+            allocFilter = ALLOC_LINKED;
+            a++;
+        }
+        else if (strcmp(argv[a], "--alloc") == 0 && a + 1 < argc && strcmp(argv[a + 1], "indexed") == 0)
+        {
+            allocFilter = ALLOC_INDEXED;
+            a++;
+        }
+        else if (strcmp(argv[a], "--alloc") == 0 && a + 1 < argc && strcmp(argv[a + 1], "linked-contiguous") == 0)
+        {
+            allocFilter = ALLOC_LINKEDCONTIG;
+            a++;
+        }
+        else if (strcmp(argv[a], "--alloc") == 0 && a + 1 < argc && strcmp(argv[a + 1], "buddy") == 0)
+        {
+            allocFilter = ALLOC_BUDDY;
+            a++;
+        }
+        else if (strcmp(argv[a], "--bench") == 0)
+        {
+            bench = 1;
+        }
+        else if (strcmp(argv[a], "--stress") == 0 && a + 1 < argc)
+        {
+            bench = 1;
+            stressThreads = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--ops") == 0 && a + 1 < argc)
+        {
+            benchConfig.ops = atoll(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--mix") == 0 && a + 1 < argc)
+        {
+            int *mix = benchConfig.mix;
+            mix[3] = 0;
+            mix[4] = 0;
+            if (sscanf(argv[++a], "%d:%d:%d:%d:%d", mix, mix + 1, mix + 2, mix + 3, mix + 4) < 3)
             {
-                instructions[tmp].fileSize = 0;
+                mix[0] = -1;
             }
         }
+        else if (strcmp(argv[a], "--fill") == 0 && a + 1 < argc)
+        {
+            benchConfig.fill = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--max-size") == 0 && a + 1 < argc)
+        {
+            benchConfig.maxSize = atoi(argv[++a]);
+        }
+        else if (strcmp(argv[a], "--dist") == 0 && a + 1 < argc && strcmp(argv[a + 1], "uniform") == 0)
+        {
+            benchConfig.skewed = 0;
+            a++;
+        }
+        else if (strcmp(argv[a], "--dist") == 0 && a + 1 < argc && strcmp(argv[a + 1], "skewed") == 0)
+        {
+            benchConfig.skewed = 1;
+            a++;
+        }
+        else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc)
+        {
+            benchConfig.seed = strtoull(argv[++a], NULL, 10);
+        }
+        else if (strcmp(argv[a], "--quiet") == 0)
+        {
+            quiet = 1;
+        }
+        else if (strcmp(argv[a], "--content-index") == 0)
+        {
+            useContentIndex = 1;
+        }
+        else if (strcmp(argv[a], "--dedup") == 0)
+        {
+            useDedup = 1;
+        }
+        else if (strcmp(argv[a], "--compress") == 0)
+        {
+            compress = 1;
+        }
+        else if (strcmp(argv[a], "--fit") == 0 && a + 1 < argc && strcmp(argv[a + 1], "first") == 0)
+        {
+            fitPolicy = FIT_FIRST;
+            a++;
+        }
+        else if (strcmp(argv[a], "--fit") == 0 && a + 1 < argc && strcmp(argv[a + 1], "best") == 0)
+        {
+            fitPolicy = FIT_BEST;
+            a++;
+        }
+        else if (strcmp(argv[a], "--fit") == 0 && a + 1 < argc && strcmp(argv[a + 1], "worst") == 0)
+        {
+            fitPolicy = FIT_WORST;
+            a++;
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (defragThread && defragMoves == 0)
+    {
+        defragMoves = 16;
+    }
+    if (cacheFrames < 0 || defragMoves < 0 || metricsEvery < 0 || stressThreads < 0 || journalOps < 0 || delayThreshold < 0 || (journalOps > 0 && imageName == NULL) ||
+        crashAfter < 0 || (crashAfter > 0 && (imageName == NULL || bench)))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
 
-        char *line = lines[x];
-        char **parts = splitString(line, ",");
+    int *mix = benchConfig.mix;
+    if (bench && (benchConfig.ops < 1 || benchConfig.ops > BENCH_MAX_OPS || mix[0] < 0 || mix[1] < 0 || mix[2] < 0 || mix[3] < 0 || mix[4] < 0 || mix[0] + mix[1] + mix[2] + mix[3] + mix[4] < 1 ||
+                  benchConfig.fill < 0 || benchConfig.fill > 100 || benchConfig.maxSize < 0 || benchConfig.maxSize > BENCH_MAX_SIZE))
+    {
+        printUsage(argv[0]);
+        return 1;
+    }
 
-        char *action = strdup(parts[0]);
-        int fileName = atoi(parts[1]);
-        instructions[x].action = action;
-        instructions[x].fileName = fileName;
+    if (stressThreads > 0 && (imageName != NULL || defragMoves > 0 || delayThreshold > 0))
+    {
+        printf("The stress benchmark runs on volumes in memory without the defragmenter or delayed allocation\n");
+        return 1;
+    }
 
-        if (parts[2] == NULL)
+    // an existing image brings its own geometry and allocation type
+    int mountImage = 0;
+    if (imageName != NULL)
+    {
+        VolumeGeometry imageGeometry;
+        int imageType;
+        if (image_peek(imageName, &imageGeometry, &imageType))
         {
-            freeSplittedString(parts);
-            // skip if this is a read/delete action
-            continue;
+            if (useContentIndex)
+            {
+                printf("The content index is not kept in %s, it cannot be used with an existing image\n", imageName);
+                return 1;
+            }
+            mountImage = 1;
+            allocFilter = imageType;
+            block_size = imageGeometry.blockSize;
+            numBlocks = imageGeometry.numBlocks;
+            fileEntrySize = imageGeometry.fileEntrySize;
         }
-
-        int fileSize = 0;
-        for (int y = 2; parts[y] != NULL; y++)
+        else if (access(imageName, F_OK) == 0)
+        {
+            printf("%s is not a volume image\n", imageName);
+            return 1;
+        }
+        else if (allocFilter == 0)
         {
-            fileSize++;
+            printf("A new image holds one allocation type, choose it with --alloc\n");
+            return 1;
         }
+    }
 
-        int *fileContent = malloc(sizeof(int) * fileSize);
-        for (int y = 0; y < fileSize; y++)
+    InstructionList list;
+    if (bench)
+    {
+        // generated workloads run without asking for anything
+        if (block_size == 0)
+        {
+            block_size = 4;
+        }
+        if (numBlocks == 0 && volumeEntries == ENTRIES)
         {
-            fileContent[y] = atoi(parts[y + 2]);
+            numBlocks = BENCH_BLOCKS;
         }
-        instructions[x].fileSize = fileSize;
-        instructions[x].fileContent = fileContent;
-        // skip others
-        freeSplittedString(parts);
     }
-    freeSplittedString(lines);
-    free(csvText);
-    instructionCount = x;
-    if (instructionCount == instructionSize)
+    else if (!readInstructions(csvName, &list))
     {
-        instructionSize++;
-        instructions = realloc(instructions, sizeof(Instruction) * instructionSize);
+        printf("Cannot read %s\n", csvName);
+        return 1;
     }
 
-    int block_size;
-    printf("Enter block size: ");
-    scanf("%d", &block_size);
+    // a volume split from entries needs room for one block and one file entry
+    long long maxBlockSize = numBlocks > 0 ? (1 << 20) : volumeEntries - 2;
+    if (block_size == 0)
+    {
+        printf("Enter block size: ");
+        if (scanf("%d", &block_size) != 1)
+        {
+            return 1;
+        }
+    }
     while (1)
     {
-        if (block_size < 2 || block_size > 126)
+        if (block_size < 2 || block_size > maxBlockSize)
         {
             if (block_size < 0)
             {
                 printf("Block size cannot be a negative number.\nEnter block size: ");
-                scanf("%d", &block_size);
             }
             else
             {
-                printf("Block size must be more 2 and less than 126.\nEnter block size: ");
-                scanf("%d", &block_size);
+                printf("Block size must be more 2 and less than %lld.\nEnter block size: ", maxBlockSize);
+            }
+            if (scanf("%d", &block_size) != 1)
+            {
+                return 1;
             }
         }
         else
@@ -1192,49 +7357,125 @@ int main()
             break;
         }
     }
-    char alloctype[4][18] = {"Contiguous", "Linked", "Indexed", "Linked Contiguous"};
 
-    for (int i = ALLOC_CONTIGUOUS; i >= ALLOC_LINKEDCONTIG; i--)
+    VolumeGeometry geometry;
+    if (numBlocks > 0)
+    {
+        geometry.blockSize = block_size;
+        geometry.numBlocks = numBlocks;
+        // one entry per block is plenty for small volumes, large ones cap the directory
+        geometry.fileEntrySize = numBlocks < (1 << 20) ? numBlocks : (1 << 20);
+    }
+    else
+    {
+        geometry = geometry_fromEntries(volumeEntries, block_size);
+    }
+    if (fileEntrySize > 0)
+    {
+        geometry.fileEntrySize = fileEntrySize;
+    }
+    char alloctype[5][18] = {"Contiguous", "Linked", "Indexed", "Linked Contiguous", "Buddy"};
+    if (bench)
+    {
+        bench_generate(&benchConfig, geometry.numBlocks * geometry.blockSize, &list);
+        printf("Workload: %lld ops, mix %d:%d:%d:%d", benchConfig.ops, mix[0], mix[1], mix[2], mix[3]);
+        if (mix[4] > 0)
+        {
+            printf(":%d", mix[4]);
+        }
+        printf(", fill %d%%, sizes 0-%d %s, seed %llu\n", benchConfig.fill, benchConfig.maxSize, benchConfig.skewed ? "skewed" : "uniform", (unsigned long long)benchConfig.seed);
+        printf("Volume: %lld blocks of %d entries, %d file entries\n", geometry.numBlocks, geometry.blockSize, geometry.fileEntrySize);
+    }
+
+    // event file: magic, version and record size, then one StoreEvent per instruction
+    FILE *eventFile = NULL;
+    if (eventsName != NULL)
+    {
+        eventFile = fopen(eventsName, "wb");
+        if (eventFile == NULL)
+        {
+            printf("Cannot write %s\n", eventsName);
+            return 1;
+        }
+        uint32_t header[3] = {0x56455346, 1, sizeof(StoreEvent)};
+        fwrite(header, sizeof(header), 1, eventFile);
+    }
+
+    // every allocation type replays the same read-only instruction list
+    ReplayJob jobs[5];
+    int replayCount = 0;
+    for (int i = ALLOC_CONTIGUOUS; i >= ALLOC_BUDDY; i--)
     {
-        printf("\nAllocation type: %s\n", alloctype[(-i) - 101]);
+        if (allocFilter != 0 && i != allocFilter)
+        {
+            continue;
+        }
+        ReplayJob *job = jobs + replayCount++;
+        job->allocationType = i;
+        job->name = alloctype[(-i) - 101];
+        job->geometry = geometry;
+        job->fitPolicy = fitPolicy;
+        job->useContentIndex = useContentIndex;
+        job->useDedup = useDedup && i == ALLOC_INDEXED;
+        job->compress = compress && i == ALLOC_INDEXED;
+        job->quiet = quiet;
+        job->list = &list;
+        job->text = stdout;
+        job->events = eventFile;
+        job->imageName = imageName;
+        job->mountImage = mountImage;
+        job->useFat = useFat && i == ALLOC_LINKED;
+        job->journalOps = journalOps;
+        job->crashAfter = crashAfter;
+        job->delayThreshold = delayThreshold;
+        job->cacheFrames = cacheFrames;
+        job->cachePolicy = cachePolicy;
+        job->device = device;
+        // linked and indexed files are not moved
+        job->defragMoves = i == ALLOC_CONTIGUOUS || i == ALLOC_LINKEDCONTIG ? defragMoves : 0;
+        job->defragThread = defragThread;
+        job->metricsEvery = metricsEvery;
+        job->failed = 0;
+        job->done = 0;
+    }
 
-        Store *s = createStore(block_size, i);
-        // printf("Block size: %d\n", s->vcb->blockSize);
-        // printf("File Entries: %d\n", s->fileEntrySize);
-        // printf("Blocks %d\n", s->numBlocks);
-        // printf("Free Blocks %d\n", s->vcb->freeBlockNum);
-        for (x = 0; x < instructionCount; x++)
+    int failed = 0;
+    if (bench)
+    {
+        // one strategy at a time so the timings do not disturb each other
+        for (int j = 0; j < replayCount && !failed; j++)
         {
-            printf("\naction: %s, fileName: %d \n", instructions[x].action, instructions[x].fileName);
-            if (strcmp("read", instructions[x].action) == 0)
+            if (stressThreads > 0)
             {
-                store_read(s, i, instructions[x].fileName);
+                stress_run(jobs + j, stressThreads);
             }
-            else if (strcmp("delete", instructions[x].action) == 0)
+            else
             {
-                store_delete(s, i, instructions[x].fileName);
+                bench_run(jobs + j);
             }
-            else if (strcmp("add", instructions[x].action) == 0)
+            failed = jobs[j].failed;
+        }
+    }
+    else
+    {
+        if (jobCount > 1)
+        {
+            failed = !replay_parallel(jobs, replayCount, jobCount, eventFile);
+        }
+        for (int j = 0; j < replayCount && !failed; j++)
+        {
+            if (jobCount <= 1)
             {
-                store_add(s, i, instructions[x].fileName, instructions[x].fileSize, instructions[x].fileContent);
-                // printf("fileContent: \n");
-                // for (int y = 0; y < instructions[x].fileSize; y++)
-                // {
-                //     printf("%d ", instructions[x].fileContent[y]);
-                // }
-                // printf("\n");
+                replay_run(jobs + j);
             }
+            failed = jobs[j].failed;
         }
-
-        store_print(s);
-
-        freeStore(s);
-        s = NULL;
     }
-    for (x = 0; x < instructionCount; x++)
+
+    if (eventFile != NULL)
     {
-        free(instructions[x].action);
-        free(instructions[x].fileContent);
+        fclose(eventFile);
     }
-    free(instructions);
+    freeInstructions(&list);
+    return failed;
 }